@@ -0,0 +1,516 @@
+#ifndef ABFT_H
+#define ABFT_H
+
+#include "element_type.h"
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Algorithm-based fault tolerance (ABFT) for C += A*B with the layouts of gemm_kernel.h.
+ * The row checksums C e and column checksums e^T C (together m+n values) are computed as
+ * C_in e + A (B e) and e^T C_in + (e^T A) B, i.e., by matrix-vector products with the checksum
+ * vectors B e and e^T A. All checksums and sums are kept in acc_t buffers: a checksum is a sum
+ * of up to n or m elements, which overflows half although every element of C is finite.
+ * C keeps its layout and all callers stay unchanged.
+ *
+ * Every checksum has a magnitude |C_in| e + |A| (|B| e) (and the same for columns), which bounds
+ * the rounding errors of both the gemm and the checksums independently of cancellation in C.
+ *
+ * abft_sum:   o_sum[l_offset+g] = sum_r x_gr and o_abs[l_offset+g] = sum_r |x_gr| with
+ *             x_gr = i_x[g*l_stride_x + r*l_stride_sum], r < l_count.
+ * abft_gemv:  io_sum[l_offset+g] += sum_r x_gr i_v[r] and io_abs[l_offset+g] += sum_r |x_gr| i_v_abs[r]
+ *             with x_gr = i_x[g'*l_stride_x + r], r < l_count. g' = g, or if l_rotate is set, the
+ *             column of C stored at position g of the (1, 2, 3, 0) groups.
+ * abft_check: one work item per row (g < l_m) and per column (g >= l_m) of C, compares the
+ *             sum of the row/column with its checksum and writes |difference| / (tolerance * magnitude)
+ *             to o_res, using l_tol_row for rows and l_tol_col for columns. Values above 1 (or NaN) are mismatches.
+ * Column sums and column checksums are both indexed by the storage position in C's groups.
+ */
+static const char * l_abft = R"(
+    __kernel void abft_sum( __global elem_t * i_x,
+                            __global acc_t  * o_sum,
+                            __global acc_t  * o_abs,
+                            __private uint    l_count,
+                            __private uint    l_stride_sum,
+                            __private uint    l_stride_x,
+                            __private uint    l_offset ){
+        size_t l_g = get_global_id(0);
+        __global elem_t * l_x = i_x + l_g*l_stride_x;
+
+        acc_t l_sum = 0;
+        acc_t l_abs = 0;
+        for(uint r = 0; r < l_count; r++){
+            acc_t l_val = LOAD(r*l_stride_sum, l_x);
+            l_sum += l_val;
+            l_abs += fabs(l_val);
+        }
+        o_sum[l_offset + l_g] = l_sum;
+        o_abs[l_offset + l_g] = l_abs;
+    }
+
+    __kernel void abft_gemv( __global elem_t * i_x,
+                             __global acc_t  * i_v,
+                             __global acc_t  * i_v_abs,
+                             __global acc_t  * io_sum,
+                             __global acc_t  * io_abs,
+                             __private uint    l_count,
+                             __private uint    l_stride_x,
+                             __private uint    l_rotate,
+                             __private uint    l_offset ){
+        size_t l_g = get_global_id(0);
+        size_t l_id = l_rotate ? (l_g & ~(size_t)3) + ((l_g + 1) & 3) : l_g;
+        __global elem_t * l_x = i_x + l_id*l_stride_x;
+
+        acc_t l_sum = 0;
+        acc_t l_abs = 0;
+        for(uint r = 0; r < l_count; r++){
+            acc_t l_val = LOAD(r, l_x);
+            l_sum += l_val * i_v[r];
+            l_abs += fabs(l_val) * i_v_abs[r];
+        }
+        io_sum[l_offset + l_g] += l_sum;
+        io_abs[l_offset + l_g] += l_abs;
+    }
+
+    __kernel void abft_check( __global elem_t * i_c,
+                              __global acc_t  * i_cs,
+                              __global acc_t  * i_mag,
+                              __private uint    l_m,
+                              __private uint    l_n,
+                              __private float   l_tol_row,
+                              __private float   l_tol_col,
+                              __global  float * o_res ){
+        size_t l_g = get_global_id(0);
+        float l_tol = l_g < l_m ? l_tol_row : l_tol_col;
+
+        acc_t l_sum = 0;
+        if( l_g < l_m ){
+            for(uint j = 0; j < l_n; j++){
+                l_sum += LOAD(l_g*l_n + j, i_c);
+            }
+        }
+        else{
+            size_t l_j = l_g - l_m;
+            for(uint i = 0; i < l_m; i++){
+                l_sum += LOAD(i*l_n + l_j, i_c);
+            }
+        }
+        o_res[l_g] = fabs(l_sum - i_cs[l_g]) / (l_tol * i_mag[l_g] + FLT_MIN);
+    }
+)";
+
+// safety factor of the checksum tolerance on the rounding error bound, see abft_tolerance
+static const double l_abft_tol_factor = 2;
+
+/**
+ * Device buffers and kernels of the checksums of one gemm.
+ **/
+struct abft_state {
+    std::size_t m;
+    std::size_t n;
+    std::size_t k;
+    cl_mem      a_cs;       // k, e^T A
+    cl_mem      a_abs;      // k, e^T |A|
+    cl_mem      b_cs;       // k, B e
+    cl_mem      b_abs;      // k, |B| e
+    cl_mem      c_cs;       // m+n, row checksums of C followed by its column checksums
+    cl_mem      c_mag;      // m+n, magnitudes of the checksums
+    cl_mem      res;        // m+n residuals of abft_check
+    cl_kernel   sum;
+    cl_kernel   gemv;
+    cl_kernel   check;
+    double      eps;        // machine epsilon of the element type, C is rounded to it once
+    double      eps_acc;    // machine epsilon of acc_t, in which the gemm and the checksums accumulate
+};
+
+/**
+ * Result of the verification.
+ * Single errors in one element or one 4x8 block of C (one work item of the gemm kernel)
+ * are located by the intersection of the mismatching rows and columns.
+ **/
+struct abft_report {
+    std::vector< std::size_t > rows;        // rows of C with mismatching checksums
+    std::vector< std::size_t > cols;        // columns of C with mismatching checksums
+    bool        single_tile;                // all mismatches lie in one 4x8 block
+    std::size_t tile_row;                   // block row (rows 4*tile_row, ..., 4*tile_row+3) if single_tile
+    std::size_t tile_col;                   // block column (columns 8*tile_col, ..., 8*tile_col+7) if single_tile
+};
+
+/**
+ * Tolerance of a checksum comparison relative to the checksum's magnitude.
+ * The rounding error of a sum of products grows linearly with the summation length and does not
+ * cancel for operands of the same sign (bound gamma_length), so the tolerance grows with it.
+ * The single rounding of C to the element type (half) does not accumulate.
+ *
+ * @param i_state checksums computed by abft_encode.
+ * @param i_length summation length, n + k for rows and m + k for columns.
+ * @return tolerance.
+ **/
+inline double abft_tolerance( abft_state const & i_state,
+                              std::size_t        i_length ){
+    return l_abft_tol_factor * ( i_state.eps_acc * i_length + i_state.eps );
+}
+
+/**
+ * Flops of the checksums relative to the 2*m*n*k flops of the gemm.
+ * Counts the sums of A and B and the matrix-vector products, each with their magnitudes.
+ *
+ * @param i_m number of rows of C.
+ * @param i_n number of columns of C.
+ * @return ratio of the flops.
+ **/
+inline double abft_flop_ratio( std::size_t i_m,
+                               std::size_t i_n ){
+    return 3.0 * (i_m + i_n) / (i_m * i_n);
+}
+
+/**
+ * Sets the arguments of a kernel and runs it on a 1D NDRange.
+ *
+ * @param i_queue command queue.
+ * @param i_kernel kernel.
+ * @param i_mems buffer arguments, passed first.
+ * @param i_n_mems number of buffer arguments.
+ * @param i_uints unsigned int arguments, passed after the buffers.
+ * @param i_n_uints number of unsigned int arguments.
+ * @param i_global_size number of work items.
+ **/
+inline void abft_enqueue( cl_command_queue i_queue,
+                          cl_kernel        i_kernel,
+                          const cl_mem   * i_mems,
+                          cl_uint          i_n_mems,
+                          const cl_uint  * i_uints,
+                          cl_uint          i_n_uints,
+                          std::size_t      i_global_size ){
+    cl_int l_err = CL_SUCCESS;
+    for( cl_uint l_ar = 0; l_ar < i_n_mems; l_ar++ ){
+        l_err = clSetKernelArg( i_kernel,
+                                l_ar,
+                                sizeof(cl_mem),
+                                i_mems+l_ar );
+        assert( l_err == CL_SUCCESS );
+    }
+    for( cl_uint l_ar = 0; l_ar < i_n_uints; l_ar++ ){
+        l_err = clSetKernelArg( i_kernel,
+                                i_n_mems+l_ar,
+                                sizeof(cl_uint),
+                                i_uints+l_ar );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    l_err = clEnqueueNDRangeKernel( i_queue,
+                                    i_kernel,
+                                    1,
+                                    NULL,
+                                    &i_global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+}
+
+/**
+ * Builds the checksum kernels.
+ * Separate from abft_encode, so the program builds are not part of timed regions.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernels run.
+ * @param o_state will be set to the kernels and the epsilons of the tolerance.
+ * @return true on success, false if a kernel could not be built (nothing to release).
+ **/
+template< typename T >
+bool abft_build( cl_context     i_context,
+                 cl_device_id   i_device,
+                 abft_state   & o_state ){
+    typedef element_type< T > elem;
+
+    o_state.eps = elem::epsilon();
+    o_state.eps_acc = std::is_same< T, cl_double >::value ? element_type< cl_double >::epsilon() : element_type< cl_float >::epsilon();
+    const char * l_names[3] = { "abft_sum", "abft_gemv", "abft_check" };
+    cl_kernel * l_kernels[3] = { &o_state.sum, &o_state.gemv, &o_state.check };
+    bool l_built = true;
+    for( int l_ke = 0; l_ke < 3; l_ke++ ){
+        *l_kernels[l_ke] = build_kernel(    i_context,
+                                            i_device,
+                                            l_abft,
+                                            l_names[l_ke],
+                                            elem::options() );
+        l_built = l_built && *l_kernels[l_ke] != NULL;
+    }
+    if( !l_built ){
+        for( int l_ke = 0; l_ke < 3; l_ke++ ){
+            if( *l_kernels[l_ke] != NULL ){
+                clReleaseKernel( *l_kernels[l_ke] );
+            }
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Computes the checksums of C += A*B.
+ * Has to be enqueued on the gemm's in-order queue before the gemm itself, since the
+ * checksums start from the sums of the input C.
+ *
+ * @param i_context OpenCL context.
+ * @param i_queue in-order command queue of the gemm.
+ * @param i_a A in the gemm kernel's layout.
+ * @param i_b B in the gemm kernel's layout.
+ * @param i_c input C in the gemm kernel's layout.
+ * @param i_m number of rows of A and C.
+ * @param i_n number of columns of B and C.
+ * @param i_k number of columns of A and rows of B.
+ * @param io_state kernels of abft_build, will be set to the checksum buffers, release with abft_release.
+ **/
+template< typename T >
+void abft_encode( cl_context       i_context,
+                  cl_command_queue i_queue,
+                  cl_mem           i_a,
+                  cl_mem           i_b,
+                  cl_mem           i_c,
+                  std::size_t      i_m,
+                  std::size_t      i_n,
+                  std::size_t      i_k,
+                  abft_state     & io_state ){
+    cl_int l_err = CL_SUCCESS;
+
+    io_state.m = i_m;
+    io_state.n = i_n;
+    io_state.k = i_k;
+
+    // checksums in the accumulation type: float for half, the element type otherwise
+    std::size_t l_acc_size = std::is_same< T, cl_double >::value ? sizeof(cl_double) : sizeof(cl_float);
+    std::size_t l_sizes[7] = { i_k, i_k, i_k, i_k, i_m+i_n, i_m+i_n, i_m+i_n };
+    std::size_t l_elem_sizes[7] = { l_acc_size, l_acc_size, l_acc_size, l_acc_size, l_acc_size, l_acc_size, sizeof(cl_float) };
+    cl_mem * l_mems[7] = { &io_state.a_cs, &io_state.a_abs, &io_state.b_cs, &io_state.b_abs, &io_state.c_cs, &io_state.c_mag, &io_state.res };
+    for( int l_bu = 0; l_bu < 7; l_bu++ ){
+        *l_mems[l_bu] = clCreateBuffer( i_context,
+                                        CL_MEM_READ_WRITE,
+                                        l_elem_sizes[l_bu]*l_sizes[l_bu],
+                                        NULL,
+                                        &l_err );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    cl_uint l_m = static_cast< cl_uint >( i_m );
+    cl_uint l_n = static_cast< cl_uint >( i_n );
+    cl_uint l_k = static_cast< cl_uint >( i_k );
+
+    // e^T A: column sums of A
+    cl_mem  l_mems_a[3]  = { i_a, io_state.a_cs, io_state.a_abs };
+    cl_uint l_uints_a[4] = { l_m, l_k, 1, 0 };
+    abft_enqueue( i_queue, io_state.sum, l_mems_a, 3, l_uints_a, 4, i_k );
+
+    // B e: sums over the columns of B
+    cl_mem  l_mems_b[3]  = { i_b, io_state.b_cs, io_state.b_abs };
+    cl_uint l_uints_b[4] = { l_n, l_k, 1, 0 };
+    abft_enqueue( i_queue, io_state.sum, l_mems_b, 3, l_uints_b, 4, i_k );
+
+    // row and column sums of the input C
+    cl_mem  l_mems_c[3]   = { i_c, io_state.c_cs, io_state.c_mag };
+    cl_uint l_uints_cr[4] = { l_n, 1, l_n, 0 };
+    abft_enqueue( i_queue, io_state.sum, l_mems_c, 3, l_uints_cr, 4, i_m );
+
+    cl_uint l_uints_cc[4] = { l_m, l_n, 1, l_m };
+    abft_enqueue( i_queue, io_state.sum, l_mems_c, 3, l_uints_cc, 4, i_n );
+
+    // C e += A (B e) and e^T C += (e^T A) B, the columns of B follow C's storage order
+    cl_mem  l_mems_gr[5]  = { i_a, io_state.b_cs, io_state.b_abs, io_state.c_cs, io_state.c_mag };
+    cl_uint l_uints_gr[4] = { l_k, l_k, 0, 0 };
+    abft_enqueue( i_queue, io_state.gemv, l_mems_gr, 5, l_uints_gr, 4, i_m );
+
+    cl_mem  l_mems_gc[5]  = { i_b, io_state.a_cs, io_state.a_abs, io_state.c_cs, io_state.c_mag };
+    cl_uint l_uints_gc[4] = { l_k, l_k, 1, l_m };
+    abft_enqueue( i_queue, io_state.gemv, l_mems_gc, 5, l_uints_gc, 4, i_n );
+}
+
+/**
+ * Verifies C against its checksums on the device.
+ * Only the m+n residuals are read back to locate mismatches.
+ *
+ * @param i_queue in-order command queue of the gemm, enqueue after the gemm.
+ * @param i_c result C in the gemm kernel's layout.
+ * @param i_state checksums computed by abft_encode.
+ * @param o_report will be set to the mismatching rows and columns.
+ * @return true if all checksums match, false otherwise.
+ **/
+inline bool abft_verify( cl_command_queue   i_queue,
+                         cl_mem             i_c,
+                         abft_state const & i_state,
+                         abft_report      & o_report ){
+    cl_int l_err = CL_SUCCESS;
+
+    // a row checksum sums n products of length k, a column checksum m of them
+    cl_float l_tols[2] = { static_cast< cl_float >( abft_tolerance( i_state, i_state.n + i_state.k ) ),
+                           static_cast< cl_float >( abft_tolerance( i_state, i_state.m + i_state.k ) ) };
+    for( cl_uint l_ar = 0; l_ar < 2; l_ar++ ){
+        l_err = clSetKernelArg( i_state.check,
+                                5+l_ar,
+                                sizeof(cl_float),
+                                l_tols+l_ar );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    l_err = clSetKernelArg( i_state.check,
+                            7,
+                            sizeof(cl_mem),
+                            &i_state.res );
+    assert( l_err == CL_SUCCESS );
+
+    cl_mem  l_mems[3]  = { i_c, i_state.c_cs, i_state.c_mag };
+    cl_uint l_uints[2] = { static_cast< cl_uint >( i_state.m ),
+                           static_cast< cl_uint >( i_state.n ) };
+    abft_enqueue( i_queue, i_state.check, l_mems, 3, l_uints, 2, i_state.m+i_state.n );
+
+    std::vector< cl_float > l_res( i_state.m+i_state.n );
+    l_err = clEnqueueReadBuffer(    i_queue,
+                                    i_state.res,
+                                    CL_TRUE,
+                                    0,
+                                    sizeof(cl_float)*l_res.size(),
+                                    l_res.data(),
+                                    0,
+                                    NULL,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+
+    o_report.rows.clear();
+    o_report.cols.clear();
+    for( std::size_t l_id = 0; l_id < l_res.size(); l_id++ ){
+        // negated to catch NaN
+        if( !( l_res[l_id] <= 1 ) ){
+            if( l_id < i_state.m ){
+                o_report.rows.push_back( l_id );
+            }
+            else{
+                // column stored at this position of C's (1, 2, 3, 0) groups
+                std::size_t l_pos = l_id - i_state.m;
+                o_report.cols.push_back( 4*(l_pos/4) + (l_pos+1)%4 );
+            }
+        }
+    }
+
+    o_report.single_tile = !o_report.rows.empty() && !o_report.cols.empty();
+    o_report.tile_row = o_report.single_tile ? o_report.rows.front()/4 : 0;
+    o_report.tile_col = o_report.single_tile ? o_report.cols.front()/8 : 0;
+    for( std::size_t l_ro = 0; l_ro < o_report.rows.size(); l_ro++ ){
+        o_report.single_tile = o_report.single_tile && o_report.rows[l_ro]/4 == o_report.tile_row;
+    }
+    for( std::size_t l_co = 0; l_co < o_report.cols.size(); l_co++ ){
+        o_report.single_tile = o_report.single_tile && o_report.cols[l_co]/8 == o_report.tile_col;
+    }
+
+    return o_report.rows.empty() && o_report.cols.empty();
+}
+
+/**
+ * Injects a fault into one element of C to test the verification.
+ * The element in the middle 4x8 block (row 1, column 5 of the block) is replaced by
+ * -(|c| + 1) / epsilon, which is far beyond the tolerance (half overflows to -inf).
+ *
+ * @param i_queue in-order command queue of the gemm, enqueue after the gemm.
+ * @param i_c result C in the gemm kernel's layout.
+ * @param i_state checksums computed by abft_encode.
+ * @param o_row will be set to the row of the fault.
+ * @param o_col will be set to the column of the fault.
+ **/
+template< typename T >
+void abft_inject( cl_command_queue   i_queue,
+                  cl_mem             i_c,
+                  abft_state const & i_state,
+                  std::size_t      & o_row,
+                  std::size_t      & o_col ){
+    typedef element_type< T > elem;
+    cl_int l_err = CL_SUCCESS;
+
+    o_row = 4*(i_state.m/8) + 1;
+    o_col = 8*(i_state.n/16) + 5;
+
+    // columns are stored as (1, 2, 3, 0) in groups of four
+    std::size_t l_offset = sizeof(T) * ( o_row*i_state.n + 4*(o_col/4) + (o_col+3)%4 );
+    T l_value;
+    l_err = clEnqueueReadBuffer(    i_queue,
+                                    i_c,
+                                    CL_TRUE,
+                                    l_offset,
+                                    sizeof(T),
+                                    &l_value,
+                                    0,
+                                    NULL,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+
+    l_value = elem::to_elem( -( std::fabs( elem::to_double( l_value ) ) + 1 ) / elem::epsilon() );
+    l_err = clEnqueueWriteBuffer(   i_queue,
+                                    i_c,
+                                    CL_TRUE,
+                                    l_offset,
+                                    sizeof(T),
+                                    &l_value,
+                                    0,
+                                    NULL,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+}
+
+/**
+ * Checks that the verification located a fault injected by abft_inject.
+ *
+ * @param i_report report of abft_verify.
+ * @param i_row row of the fault.
+ * @param i_col column of the fault.
+ * @return true if exactly the 4x8 block of the fault was reported, false otherwise.
+ **/
+inline bool abft_located( abft_report const & i_report,
+                          std::size_t         i_row,
+                          std::size_t         i_col ){
+    return i_report.single_tile && i_report.tile_row == i_row/4 && i_report.tile_col == i_col/8;
+}
+
+/**
+ * Prints the result of the verification.
+ *
+ * @param i_report report of abft_verify.
+ **/
+inline void print_abft_report( abft_report const & i_report ){
+    if( i_report.rows.empty() && i_report.cols.empty() ){
+        std::cout << "abft: all row and column checksums match" << std::endl;
+        return;
+    }
+
+    std::cout << "abft: " << i_report.rows.size() << " rows and " << i_report.cols.size() << " columns of C do not match their checksums" << std::endl;
+    if( i_report.single_tile ){
+        std::cout << "abft: error located in the 4x8 block of rows " << 4*i_report.tile_row << "-" << 4*i_report.tile_row+3
+                  << " and columns " << 8*i_report.tile_col << "-" << 8*i_report.tile_col+7 << std::endl;
+    }
+    else{
+        std::cout << "abft: errors span multiple blocks, C has to be recomputed" << std::endl;
+    }
+}
+
+/**
+ * Releases the checksum buffers and kernels.
+ *
+ * @param io_state state of abft_build and abft_encode.
+ **/
+inline void abft_release( abft_state & io_state ){
+    clReleaseMemObject( io_state.a_cs );
+    clReleaseMemObject( io_state.a_abs );
+    clReleaseMemObject( io_state.b_cs );
+    clReleaseMemObject( io_state.b_abs );
+    clReleaseMemObject( io_state.c_cs );
+    clReleaseMemObject( io_state.c_mag );
+    clReleaseMemObject( io_state.res );
+    clReleaseKernel( io_state.sum );
+    clReleaseKernel( io_state.gemv );
+    clReleaseKernel( io_state.check );
+}
+
+#endif
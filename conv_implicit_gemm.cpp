@@ -0,0 +1,379 @@
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "element_type.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Implicit-GEMM 2D convolution with the m=4 x n=8 block of the gemm kernel.
+ * GEMM view: M = output channels, N = batch*OH*OW output pixels, K = IC*KH*KW.
+ * A are the weights (OIHW for NCHW, OHWI for NHWC), each row zero padded to a
+ * multiple of 4. The columns of B are never stored: every K step of the tile load
+ * gathers the four input values of the 8 pixels straight from the input tensor,
+ * which is what im2col would have written.
+ * All shape parameters are build time constants (-D), layout NHWC if CONV_NHWC is defined.
+ */
+static const char * l_conv = R"(
+    #define K_SIZE (IC*KH*KW)
+    #define K4     ((K_SIZE+3)/4)
+    #define OHW    (OH*OW)
+    #define NP     (NB*OHW)
+
+    // input value of the implicit im2col matrix, 0 in the padding
+    inline acc_t conv_in( __global elem_t * i_in,
+                          int n,
+                          int ic,
+                          int ih,
+                          int iw ){
+        if( ih < 0 || ih >= IH || iw < 0 || iw >= IW ){
+            return 0;
+        }
+    #ifdef CONV_NHWC
+        return LOAD(((n*IH + ih)*IW + iw)*IC + ic, i_in);
+    #else
+        return LOAD(((n*IC + ic)*IH + ih)*IW + iw, i_in);
+    #endif
+    }
+
+    __kernel void conv( __global elem_t * i_in,
+                        __global elem_t * i_w,
+                        __global elem_t * o_out ){
+        const int l_oc0 = get_global_id(1)*4;               // first output channel of the block
+        const int l_p0  = get_global_id(0)*8;               // first output pixel of the block
+
+        // batch index and top left input coordinates of the 8 pixels
+        int l_pn[8];
+        int l_ph[8];
+        int l_pw[8];
+        for(int j = 0; j < 8; j++){
+            int l_p = min(l_p0+j, NP-1);
+            int l_r = l_p%OHW;
+            l_pn[j] = l_p/OHW;
+            l_ph[j] = (l_r/OW)*SH - PH;
+            l_pw[j] = (l_r%OW)*SW - PW;
+        }
+
+        acc4_t l_acc[4][2];
+        for(int m = 0; m < 4; m++){
+            l_acc[m][0] = (acc4_t)(0);
+            l_acc[m][1] = (acc4_t)(0);
+        }
+
+        // position (ic, kh, kw) of the current k, advanced incrementally
+        int l_ic = 0;
+        int l_kh = 0;
+        int l_kw = 0;
+
+        for(int i = 0; i < K4; i++){
+            // tile load of B: im2col addressing on the fly
+            acc_t l_bv[4][8];
+            for(int q = 0; q < 4; q++){
+                bool l_valid = i*4+q < K_SIZE;
+                for(int j = 0; j < 8; j++){
+                    l_bv[q][j] = l_valid ? conv_in(i_in, l_pn[j], l_ic, l_ph[j]+l_kh*DH, l_pw[j]+l_kw*DW) : 0;
+                }
+    #ifdef CONV_NHWC
+                if(++l_ic == IC){ l_ic = 0; if(++l_kw == KW){ l_kw = 0; l_kh++; } }
+    #else
+                if(++l_kw == KW){ l_kw = 0; if(++l_kh == KH){ l_kh = 0; l_ic++; } }
+    #endif
+            }
+            acc4_t l_b[8];
+            for(int j = 0; j < 8; j++){
+                l_b[j] = (acc4_t)(l_bv[0][j], l_bv[1][j], l_bv[2][j], l_bv[3][j]);
+            }
+
+            for(int m = 0; m < 4; m++){                     // m=4 in one block
+                acc4_t l_a_vec = LOAD4(i, i_w + (l_oc0+m)*K4*4);
+                for(int n = 0; n < 2; n++){                 // n=8 in one block with 4 elements per vector
+                    l_acc[m][n].w += dot(l_a_vec, l_b[n*4+0]);
+                    l_acc[m][n].x += dot(l_a_vec, l_b[n*4+1]);
+                    l_acc[m][n].y += dot(l_a_vec, l_b[n*4+2]);
+                    l_acc[m][n].z += dot(l_a_vec, l_b[n*4+3]);
+                }
+            }
+        }
+
+        for(int m = 0; m < 4; m++){
+            for(int j = 0; j < 8; j++){
+                int l_p = l_p0+j;
+                if(l_p < NP){
+                    acc4_t l_vec = l_acc[m][j/4];
+                    acc_t l_val = (j%4 == 0) ? l_vec.w : (j%4 == 1) ? l_vec.x : (j%4 == 2) ? l_vec.y : l_vec.z;
+    #ifdef CONV_NHWC
+                    STORE(l_val, l_p*OC + l_oc0+m, o_out);
+    #else
+                    STORE(l_val, (l_p/OHW*OC + l_oc0+m)*OHW + l_p%OHW, o_out);
+    #endif
+                }
+            }
+        }
+    }
+)";
+
+int main( int i_argc, char * i_argv[] ){
+    std::cout << "starting implicit gemm convolution" << std::endl;
+
+    cl_int l_err = CL_SUCCESS;
+
+    /*
+     * shape: conv_implicit_gemm [nchw|nhwc] [N IC IH IW OC KH KW stride pad dilation]
+     */
+    std::string l_layout = i_argc > 1 ? i_argv[1] : "nchw";
+    if( ( l_layout != "nchw" && l_layout != "nhwc" ) || ( i_argc != 1 && i_argc != 2 && i_argc != 12 ) ){
+        std::cerr << "usage: conv_implicit_gemm [nchw|nhwc] [N IC IH IW OC KH KW stride pad dilation], either all or none of the sizes" << std::endl;
+        return 1;
+    }
+    bool l_nhwc = l_layout == "nhwc";
+    int l_shape[10] = { 1, 16, 56, 56, 32, 3, 3, 1, 1, 1 };
+    if( i_argc == 12 ){
+        for( int l_ar = 0; l_ar < 10; l_ar++ ){
+            l_shape[l_ar] = std::atoi( i_argv[2+l_ar] );
+        }
+    }
+    int l_nb = l_shape[0];
+    int l_ic = l_shape[1];
+    int l_ih = l_shape[2];
+    int l_iw = l_shape[3];
+    int l_oc = l_shape[4];
+    int l_kh = l_shape[5];
+    int l_kw = l_shape[6];
+    int l_s  = l_shape[7];
+    int l_p  = l_shape[8];
+    int l_d  = l_shape[9];
+    if( l_nb < 1 || l_ic < 1 || l_ih < 1 || l_iw < 1 || l_oc < 1 || l_kh < 1 || l_kw < 1 || l_s < 1 || l_p < 0 || l_d < 1 ){
+        std::cerr << "sizes, stride and dilation have to be positive and the padding non-negative" << std::endl;
+        return 1;
+    }
+    // extent of the padded input covered by the dilated filter, truncating division is only valid if non-negative
+    int l_oh_span = l_ih + 2*l_p - l_d*(l_kh-1) - 1;
+    int l_ow_span = l_iw + 2*l_p - l_d*(l_kw-1) - 1;
+    if( l_oh_span < 0 || l_ow_span < 0 ){
+        std::cerr << "the dilated filter is larger than the padded input" << std::endl;
+        return 1;
+    }
+    int l_oh = l_oh_span / l_s + 1;
+    int l_ow = l_ow_span / l_s + 1;
+    int l_k_size = l_ic*l_kh*l_kw;
+    int l_k4 = (l_k_size+3)/4;
+    int l_np = l_nb*l_oh*l_ow;
+
+    std::cout << "  layout: " << ( l_nhwc ? "NHWC" : "NCHW" )
+              << " N=" << l_nb << " IC=" << l_ic << " IH=" << l_ih << " IW=" << l_iw
+              << " OC=" << l_oc << " KH=" << l_kh << " KW=" << l_kw
+              << " stride=" << l_s << " pad=" << l_p << " dilation=" << l_d
+              << " -> OH=" << l_oh << " OW=" << l_ow << std::endl;
+    if( l_oc % 4 != 0 ){
+        std::cerr << "OC has to be a multiple of 4" << std::endl;
+        return 1;
+    }
+
+    // number of platforms
+    cl_uint l_n_platforms = 0;
+    l_err = clGetPlatformIDs( 0,
+                              NULL,
+                              &l_n_platforms );
+    assert( l_err == CL_SUCCESS );
+    std::cout << "number of platforms: " << l_n_platforms << std::endl;
+    assert( l_n_platforms > 0);
+
+    // platform IDs
+    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
+    l_err = clGetPlatformIDs( l_n_platforms,
+                              l_platform_ids,
+                              NULL);
+    assert( l_err == CL_SUCCESS );
+
+    // number of devices
+    cl_uint l_n_devices = 0;
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            0,
+                            NULL,
+                            &l_n_devices );
+    assert( l_err == CL_SUCCESS );
+
+    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            l_n_devices,
+                            l_device_ids,
+                            NULL );
+    assert( l_err == CL_SUCCESS );
+
+    /*
+     * prepare program execution
+     */
+    cl_context l_context = clCreateContext( NULL,
+                                            1,
+                                            l_device_ids+0,
+                                            NULL,
+                                            NULL,
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    std::string l_options = "";
+    l_options += " -D NB=" + std::to_string(l_nb);
+    l_options += " -D IC=" + std::to_string(l_ic);
+    l_options += " -D IH=" + std::to_string(l_ih);
+    l_options += " -D IW=" + std::to_string(l_iw);
+    l_options += " -D OC=" + std::to_string(l_oc);
+    l_options += " -D KH=" + std::to_string(l_kh);
+    l_options += " -D KW=" + std::to_string(l_kw);
+    l_options += " -D SH=" + std::to_string(l_s) + " -D SW=" + std::to_string(l_s);
+    l_options += " -D PH=" + std::to_string(l_p) + " -D PW=" + std::to_string(l_p);
+    l_options += " -D DH=" + std::to_string(l_d) + " -D DW=" + std::to_string(l_d);
+    l_options += " -D OH=" + std::to_string(l_oh);
+    l_options += " -D OW=" + std::to_string(l_ow);
+    if( l_nhwc ){
+        l_options += " -D CONV_NHWC";
+    }
+
+    cl_kernel l_conv_kernel = build_kernel( l_context,
+                                            l_device_ids[0],
+                                            l_conv,
+                                            "conv",
+                                            l_options );
+    if( l_conv_kernel == NULL ){
+        return 1;
+    }
+    std::cout << "successfully build program" << std::endl;
+
+    // host memory: random input and weights, weights' rows zero padded to l_k4*4
+    std::vector< cl_float > l_in( std::size_t(l_nb)*l_ic*l_ih*l_iw );
+    std::vector< cl_float > l_w( std::size_t(l_oc)*l_k4*4, 0 );
+    std::vector< cl_float > l_out( std::size_t(l_np)*l_oc );
+    std::vector< cl_float > l_ref( std::size_t(l_np)*l_oc, 0 );
+    for( std::size_t l_en = 0; l_en < l_in.size(); l_en++ ){
+        l_in[l_en] = static_cast< cl_float >( std::rand() ) / RAND_MAX - 0.5f;
+    }
+    for( int l_o = 0; l_o < l_oc; l_o++ ){
+        for( int l_kk = 0; l_kk < l_k_size; l_kk++ ){
+            l_w[l_o*l_k4*4 + l_kk] = static_cast< cl_float >( std::rand() ) / RAND_MAX - 0.5f;
+        }
+    }
+
+    // host reference: direct convolution
+    for( int l_n = 0; l_n < l_nb; l_n++ )
+    for( int l_o = 0; l_o < l_oc; l_o++ )
+    for( int l_y = 0; l_y < l_oh; l_y++ )
+    for( int l_x = 0; l_x < l_ow; l_x++ ){
+        double l_sum = 0;
+        for( int l_c = 0; l_c < l_ic; l_c++ )
+        for( int l_r = 0; l_r < l_kh; l_r++ )
+        for( int l_t = 0; l_t < l_kw; l_t++ ){
+            int l_yi = l_y*l_s - l_p + l_r*l_d;
+            int l_xi = l_x*l_s - l_p + l_t*l_d;
+            if( l_yi < 0 || l_yi >= l_ih || l_xi < 0 || l_xi >= l_iw ){
+                continue;
+            }
+            std::size_t l_id_in = l_nhwc ? ((std::size_t(l_n)*l_ih + l_yi)*l_iw + l_xi)*l_ic + l_c
+                                         : ((std::size_t(l_n)*l_ic + l_c)*l_ih + l_yi)*l_iw + l_xi;
+            int l_kk = l_nhwc ? (l_r*l_kw + l_t)*l_ic + l_c
+                              : (l_c*l_kh + l_r)*l_kw + l_t;
+            l_sum += l_in[l_id_in] * l_w[l_o*l_k4*4 + l_kk];
+        }
+        std::size_t l_pix = (std::size_t(l_n)*l_oh + l_y)*l_ow + l_x;
+        std::size_t l_id_out = l_nhwc ? l_pix*l_oc + l_o
+                                      : (std::size_t(l_n)*l_oc + l_o)*l_oh*l_ow + std::size_t(l_y)*l_ow + l_x;
+        l_ref[l_id_out] = static_cast< cl_float >( l_sum );
+    }
+
+    cl_mem l_in_device = clCreateBuffer(    l_context,
+                                            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                            sizeof(cl_float)*l_in.size(),
+                                            l_in.data(),
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_mem l_w_device = clCreateBuffer( l_context,
+                                        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        sizeof(cl_float)*l_w.size(),
+                                        l_w.data(),
+                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_mem l_out_device = clCreateBuffer(   l_context,
+                                            CL_MEM_WRITE_ONLY,
+                                            sizeof(cl_float)*l_out.size(),
+                                            NULL,
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_command_queue l_queue = clCreateCommandQueue(    l_context,
+                                                        l_device_ids[0],
+                                                        CL_QUEUE_PROFILING_ENABLE,
+                                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    l_err  = clSetKernelArg( l_conv_kernel, 0, sizeof(cl_mem), &l_in_device );
+    l_err |= clSetKernelArg( l_conv_kernel, 1, sizeof(cl_mem), &l_w_device );
+    l_err |= clSetKernelArg( l_conv_kernel, 2, sizeof(cl_mem), &l_out_device );
+    assert( l_err == CL_SUCCESS );
+
+    // l_np/8 x l_oc/4 work items
+    std::size_t l_global_size[2] = { std::size_t(l_np+7)/8, std::size_t(l_oc)/4 };
+
+    std::cout << "running kernel" << std::endl;
+    cl_event l_event;
+    l_err = clEnqueueNDRangeKernel( l_queue,
+                                    l_conv_kernel,
+                                    2,
+                                    NULL,
+                                    l_global_size,
+                                    NULL,
+                                    0,
+                                    NULL,
+                                    &l_event );
+    assert( l_err == CL_SUCCESS );
+
+    l_err = clEnqueueReadBuffer(    l_queue,
+                                    l_out_device,
+                                    CL_TRUE,
+                                    0,
+                                    sizeof(cl_float)*l_out.size(),
+                                    l_out.data(),
+                                    0,
+                                    NULL,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+
+    cl_ulong l_start = 0;
+    cl_ulong l_end = 0;
+    clGetEventProfilingInfo( l_event, CL_PROFILING_COMMAND_START, sizeof(l_start), &l_start, NULL );
+    clGetEventProfilingInfo( l_event, CL_PROFILING_COMMAND_END,   sizeof(l_end),   &l_end,   NULL );
+    clReleaseEvent( l_event );
+    double l_time = (l_end - l_start) * 1.0E-9;
+
+    double l_max_err = 0;
+    for( std::size_t l_en = 0; l_en < l_out.size(); l_en++ ){
+        l_max_err = std::max( l_max_err, std::abs( double(l_out[l_en]) - l_ref[l_en] ) );
+    }
+
+    std::cout << "max abs error vs. host reference: " << l_max_err << std::endl;
+    std::cout << "kernel: " << l_time << " s, "
+              << 2.0E-9 * l_np * l_oc * l_k_size / l_time << " GFLOPS" << std::endl;
+
+    clReleaseMemObject( l_in_device );
+    clReleaseMemObject( l_w_device );
+    clReleaseMemObject( l_out_device );
+    clReleaseKernel( l_conv_kernel );
+    clReleaseCommandQueue( l_queue );
+    clReleaseContext( l_context );
+
+    delete [] l_device_ids;
+    delete [] l_platform_ids;
+
+    std::cout << "implicit gemm convolution ended" << std::endl;
+
+    return l_max_err < 1.0E-3 ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+#ifndef ELEMENT_TYPE_H
+#define ELEMENT_TYPE_H
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else 
+#include <CL/cl.h>
+#endif
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/*
+ * Element type definitions shared by all kernels, prepended to the kernel source.
+ * elem_t is the storage type, acc_t/acc4_t are used for arithmetic.
+ * Kernels access global memory only through LOAD/STORE and LOAD4/STORE4, so half
+ * values are converted to float on load (vload_half) and back on store (vstore_half).
+ * The type is selected with -D ELEM_DOUBLE or -D ELEM_HALF, float is the default.
+ */
+static const char * l_element_type_defs = R"(
+    #if defined(ELEM_DOUBLE)
+    #pragma OPENCL EXTENSION cl_khr_fp64 : enable
+    typedef double  elem_t;
+    typedef double  acc_t;
+    typedef double4 acc4_t;
+    #define LOAD(o, p)      (p)[o]
+    #define STORE(v, o, p)  (p)[o] = (v)
+    #define LOAD4(o, p)     vload4(o, p)
+    #define STORE4(v, o, p) vstore4(v, o, p)
+    #elif defined(ELEM_HALF)
+    #pragma OPENCL EXTENSION cl_khr_fp16 : enable
+    typedef half    elem_t;
+    typedef float   acc_t;
+    typedef float4  acc4_t;
+    #define LOAD(o, p)      vload_half(o, p)
+    #define STORE(v, o, p)  vstore_half(v, o, p)
+    #define LOAD4(o, p)     vload_half4(o, p)
+    #define STORE4(v, o, p) vstore_half4(v, o, p)
+    #else
+    typedef float   elem_t;
+    typedef float   acc_t;
+    typedef float4  acc4_t;
+    #define LOAD(o, p)      (p)[o]
+    #define STORE(v, o, p)  (p)[o] = (v)
+    #define LOAD4(o, p)     vload4(o, p)
+    #define STORE4(v, o, p) vstore4(v, o, p)
+    #endif
+)";
+
+/**
+ * Converts a float to IEEE 754 half precision (round to nearest even).
+ *
+ * @param i_value float value.
+ * @return half value.
+ **/
+inline cl_half float_to_half( float i_value ){
+    uint32_t l_bits = 0;
+    std::memcpy( &l_bits, &i_value, sizeof(l_bits) );
+
+    uint32_t l_sign = (l_bits >> 16) & 0x8000;
+    int32_t  l_exp  = static_cast< int32_t >( (l_bits >> 23) & 0xff ) - 127 + 15;
+    uint32_t l_mant = l_bits & 0x7fffff;
+
+    // inf and nan
+    if( ((l_bits >> 23) & 0xff) == 0xff ){
+        return static_cast< cl_half >( l_sign | 0x7c00 | (l_mant ? 0x200 : 0) );
+    }
+    // overflow
+    if( l_exp >= 31 ){
+        return static_cast< cl_half >( l_sign | 0x7c00 );
+    }
+    // subnormal or zero
+    if( l_exp <= 0 ){
+        if( l_exp < -10 ){
+            return static_cast< cl_half >( l_sign );
+        }
+        l_mant |= 0x800000;
+        uint32_t l_shift = static_cast< uint32_t >( 14 - l_exp );
+        uint32_t l_half  = l_mant >> l_shift;
+        uint32_t l_rest  = l_mant & ((1u << l_shift) - 1);
+        uint32_t l_mid   = 1u << (l_shift - 1);
+        if( l_rest > l_mid || (l_rest == l_mid && (l_half & 1)) ){
+            l_half++;
+        }
+        return static_cast< cl_half >( l_sign | l_half );
+    }
+
+    uint32_t l_half = l_sign | (static_cast< uint32_t >( l_exp ) << 10) | (l_mant >> 13);
+    uint32_t l_rest = l_mant & 0x1fff;
+    if( l_rest > 0x1000 || (l_rest == 0x1000 && (l_half & 1)) ){
+        l_half++;   // may carry into the exponent, which is the correct rounding
+    }
+    return static_cast< cl_half >( l_half );
+}
+
+/**
+ * Converts an IEEE 754 half precision value to float.
+ *
+ * @param i_value half value.
+ * @return float value.
+ **/
+inline float half_to_float( cl_half i_value ){
+    uint32_t l_sign = (static_cast< uint32_t >( i_value ) & 0x8000) << 16;
+    uint32_t l_exp  = (i_value >> 10) & 0x1f;
+    uint32_t l_mant = i_value & 0x3ff;
+    uint32_t l_bits = 0;
+
+    if( l_exp == 0x1f ){
+        l_bits = l_sign | 0x7f800000 | (l_mant << 13);
+    }
+    else if( l_exp != 0 ){
+        l_bits = l_sign | ((l_exp - 15 + 127) << 23) | (l_mant << 13);
+    }
+    else if( l_mant != 0 ){
+        // subnormal half, normalize
+        l_exp = 127 - 15 + 1;
+        while( (l_mant & 0x400) == 0 ){
+            l_mant <<= 1;
+            l_exp--;
+        }
+        l_bits = l_sign | (l_exp << 23) | ((l_mant & 0x3ff) << 13);
+    }
+    else{
+        l_bits = l_sign;
+    }
+
+    float l_value = 0;
+    std::memcpy( &l_value, &l_bits, sizeof(l_value) );
+    return l_value;
+}
+
+/**
+ * Host side description of an element type.
+ * vec4 is the matching four element vector, npy_descr the dtype in .npy files,
+ * to_elem and to_double convert between the element type and double,
+ * epsilon is the machine epsilon of the storage type.
+ **/
+template< typename T > struct element_type;
+
+template<> struct element_type< cl_float > {
+    typedef cl_float4 vec4;
+    static const char * name(){ return "float"; }
+    static const char * npy_descr(){ return "<f4"; }
+    static const char * extension(){ return NULL; }
+    static const char * options(){ return ""; }
+    static cl_float to_elem( double i_value ){ return static_cast< cl_float >( i_value ); }
+    static double to_double( cl_float i_value ){ return i_value; }
+    static double epsilon(){ return 1.0 / (1 << 23); }
+};
+
+template<> struct element_type< cl_double > {
+    typedef cl_double4 vec4;
+    static const char * name(){ return "double"; }
+    static const char * npy_descr(){ return "<f8"; }
+    static const char * extension(){ return "cl_khr_fp64"; }
+    static const char * options(){ return " -D ELEM_DOUBLE"; }
+    static cl_double to_elem( double i_value ){ return i_value; }
+    static double to_double( cl_double i_value ){ return i_value; }
+    static double epsilon(){ return 1.0 / (1ull << 52); }
+};
+
+template<> struct element_type< cl_half > {
+    typedef cl_half4 vec4;
+    static const char * name(){ return "half"; }
+    static const char * npy_descr(){ return "<f2"; }
+    static const char * extension(){ return "cl_khr_fp16"; }
+    static const char * options(){ return " -D ELEM_HALF"; }
+    static cl_half to_elem( double i_value ){ return float_to_half( static_cast< float >( i_value ) ); }
+    static double to_double( cl_half i_value ){ return half_to_float( i_value ); }
+    static double epsilon(){ return 1.0 / (1 << 10); }
+};
+
+/**
+ * Checks if the device supports an extension.
+ *
+ * @param i_device device.
+ * @param i_extension name of the extension, NULL is always supported.
+ * @return true if the extension is supported, false otherwise.
+ **/
+inline bool device_supports( cl_device_id i_device,
+                             const char * i_extension ){
+    if( i_extension == NULL ){
+        return true;
+    }
+
+    std::size_t l_size = 0;
+    cl_int l_err = clGetDeviceInfo( i_device,
+                                    CL_DEVICE_EXTENSIONS,
+                                    0,
+                                    NULL,
+                                    &l_size );
+    assert( l_err == CL_SUCCESS );
+
+    std::string l_extensions( l_size, '\0' );
+    l_err = clGetDeviceInfo(    i_device,
+                                CL_DEVICE_EXTENSIONS,
+                                l_size,
+                                &l_extensions[0],
+                                NULL );
+    assert( l_err == CL_SUCCESS );
+
+    std::istringstream l_stream( l_extensions.c_str() );
+    std::string l_ext;
+    while( l_stream >> l_ext ){
+        if( l_ext == i_extension ){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Builds a program from source and creates one of its kernels.
+ * The element type definitions are prepended to the source.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device for which the program is built.
+ * @param i_source kernel source.
+ * @param i_name name of the kernel.
+ * @param i_options build options passed to the OpenCL compiler.
+ * @return kernel or NULL if the build failed.
+ **/
+inline cl_kernel build_kernel( cl_context          i_context,
+                               cl_device_id        i_device,
+                               const char        * i_source,
+                               const char        * i_name,
+                               std::string const & i_options ){
+    cl_int l_err = CL_SUCCESS;
+
+    const char * l_sources[2] = { l_element_type_defs, i_source };
+    cl_program l_program = clCreateProgramWithSource(   i_context,
+                                                        2,
+                                                        l_sources,
+                                                        NULL,
+                                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    l_err = clBuildProgram( l_program,
+                            1,
+                            &i_device,
+                            i_options.c_str(),
+                            NULL,
+                            NULL);
+
+    if ( l_err != CL_SUCCESS )
+    {
+        std::cerr << "failed to build program with options \"" << i_options << "\"!" << std::endl;
+
+        cl_char l_tmp_string[8192] = {0};
+        clGetProgramBuildInfo(  l_program,
+                                i_device,
+                                CL_PROGRAM_BUILD_LOG,
+                                sizeof(l_tmp_string),
+                                l_tmp_string,
+                                NULL );
+        std::cerr << l_tmp_string << std::endl;
+        clReleaseProgram( l_program );
+        return NULL;
+    }
+
+    cl_kernel l_kernel = clCreateKernel(    l_program,
+                                            i_name,
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    // the kernel keeps its own reference to the program
+    clReleaseProgram( l_program );
+
+    return l_kernel;
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef GEMM_KERNEL_H
+#define GEMM_KERNEL_H
+
+#include "element_type.h"
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+
+/*
+ * The gemm kernel computes one m=4 x n=8 block of C per work item.
+ * If GEMM_M, GEMM_N and GEMM_K are defined at build time (-D), the shape is
+ * baked into the kernel and the runtime arguments l_m, l_n, l_k are ignored.
+ * This lets the compiler fold all index math into constants and, together
+ * with GEMM_FULL_UNROLL, fully unroll the K loop for small K.
+ * The element type is selected as described in element_type.h.
+ */
+static const char * l_gemm = R"(
+    #ifdef GEMM_M
+    #define L_M GEMM_M
+    #define L_N GEMM_N
+    #define L_K GEMM_K
+    #else
+    #define L_M l_m
+    #define L_N l_n
+    #define L_K l_k
+    #endif
+
+    #ifdef GEMM_FULL_UNROLL
+    #define GEMM_UNROLL _Pragma("unroll")
+    #else
+    #define GEMM_UNROLL
+    #endif
+
+    __kernel void gemm( __global elem_t * i_a,
+                        __global elem_t * i_b,
+                        __global elem_t * o_c,
+                        __private uint l_m,
+                        __private uint l_n,
+                        __private uint l_k ){
+
+        const size_t l_k4 = L_K/4;                          // vectors per row of A / column of B
+        const size_t l_n4 = L_N/4;                          // vectors per row of C
+        const size_t l_n8 = L_N/8;                          // blocks per row of C
+
+        size_t l_gwid = get_global_id(0);
+        size_t l_gwid_x = l_gwid%l_n8;
+        size_t l_gwid_y = l_gwid/l_n8;
+
+        __global elem_t * l_a = i_a + l_gwid_y*4*L_K;      // first row of the m=4 block
+        __global elem_t * l_b = i_b + l_gwid_x*8*L_K;      // first column of the n=8 block
+        __global elem_t * l_c = o_c + l_gwid_y*4*L_N + l_gwid_x*8;    // 8 vector blocking
+
+        for(size_t m = 0; m < 4; m++){                      // m=4 in one block
+            __global elem_t * l_a_row = l_a + m*L_K;
+            for(size_t n = 0; n < 2; n++){                  // n=8 in one block with 4 elements per vector
+                __global elem_t * l_b_col = l_b + n*4*L_K;
+                acc4_t l_acc = LOAD4(m*l_n4+n, l_c);
+                GEMM_UNROLL
+                for(size_t i = 0; i < l_k4; i++){
+                    acc4_t l_a_vec = LOAD4(i, l_a_row);
+                    l_acc.w += dot(l_a_vec, LOAD4(i+0*l_k4, l_b_col));
+                    l_acc.x += dot(l_a_vec, LOAD4(i+1*l_k4, l_b_col));
+                    l_acc.y += dot(l_a_vec, LOAD4(i+2*l_k4, l_b_col));
+                    l_acc.z += dot(l_a_vec, LOAD4(i+3*l_k4, l_b_col));
+                }
+                STORE4(l_acc, m*l_n4+n, l_c);
+            }
+        }
+    }
+)";
+
+// shapes (m, n, k) for which a specialized kernel is built
+static const std::size_t l_gemm_shapes[][3] = { {   4,    8,    8 },
+                                                {  64,   64,   64 },
+                                                { 128,  128,  128 },
+                                                { 256,  256,  256 },
+                                                { 512,  512,  512 } };
+
+// largest k for which the specialized kernel fully unrolls the K loop
+static const std::size_t l_gemm_max_unroll_k = 64;
+
+// built kernels per (context, device, element type, m, n, k), m=n=k=0 is the generic kernel
+static std::map< std::tuple< cl_context, cl_device_id, std::string, std::size_t, std::size_t, std::size_t >, cl_kernel > l_gemm_cache;
+
+/**
+ * Returns the gemm kernel for the given element type and shape.
+ * Shapes listed in l_gemm_shapes get a kernel with m, n, k as compile time constants,
+ * all other shapes use the generic kernel. Kernels are built once and cached.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @param i_m number of rows of A and C.
+ * @param i_n number of columns of B and C.
+ * @param i_k number of columns of A and rows of B.
+ * @return kernel or NULL if the build failed.
+ **/
+template< typename T >
+cl_kernel get_gemm_kernel( cl_context   i_context,
+                           cl_device_id i_device,
+                           std::size_t  i_m,
+                           std::size_t  i_n,
+                           std::size_t  i_k ){
+    bool l_specialized = false;
+    for( std::size_t l_sh = 0; l_sh < sizeof(l_gemm_shapes)/sizeof(l_gemm_shapes[0]); l_sh++ ){
+        if(    l_gemm_shapes[l_sh][0] == i_m
+            && l_gemm_shapes[l_sh][1] == i_n
+            && l_gemm_shapes[l_sh][2] == i_k ){
+            l_specialized = true;
+        }
+    }
+    if( !l_specialized ){
+        i_m = i_n = i_k = 0;
+    }
+
+    std::tuple< cl_context, cl_device_id, std::string, std::size_t, std::size_t, std::size_t > l_key( i_context,
+                                                                                                      i_device,
+                                                                                                      element_type< T >::name(),
+                                                                                                      i_m,
+                                                                                                      i_n,
+                                                                                                      i_k );
+    if( l_gemm_cache.count( l_key ) > 0 ){
+        return l_gemm_cache[l_key];
+    }
+
+    std::string l_options = element_type< T >::options();
+    if( l_specialized ){
+        l_options += " -D GEMM_M=" + std::to_string(i_m);
+        l_options += " -D GEMM_N=" + std::to_string(i_n);
+        l_options += " -D GEMM_K=" + std::to_string(i_k);
+        if( i_k <= l_gemm_max_unroll_k ){
+            l_options += " -D GEMM_FULL_UNROLL";
+        }
+        std::cout << "building specialized " << element_type< T >::name() << " gemm kernel for m=" << i_m << " n=" << i_n << " k=" << i_k << std::endl;
+    }
+    else{
+        std::cout << "building generic " << element_type< T >::name() << " gemm kernel" << std::endl;
+    }
+
+    cl_kernel l_kernel = build_kernel(  i_context,
+                                        i_device,
+                                        l_gemm,
+                                        "gemm",
+                                        l_options );
+    if( l_kernel != NULL ){
+        l_gemm_cache[l_key] = l_kernel;
+    }
+
+    return l_kernel;
+}
+
+#endif
@@ -4,150 +4,737 @@
 #include <CL/cl.h>
 #endif
 
+#include "abft.h"
+#include "element_type.h"
+#include "gemm_kernel.h"
+#include "matrix_io.h"
+#include "packing.h"
+
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Tunable variant of the gemm kernel in gemm_kernel.h, same data layout and arguments.
+ * Every work item computes a TILE_M x TILE_N block of C (TILE_N multiple of 4),
+ * A and B are read with vectors of width VEC (1, 2 or 4).
+ * Work groups are WG_X x WG_Y work items. If TILE_K > 0 the work group stages
+ * TILE_K wide slices of A and B in local memory, otherwise all reads go to global memory.
+ * The NDRange is 2D with l_n/TILE_N x l_m/TILE_M work items.
+ */
+static const char * l_gemm_tuned = R"(
+    #if VEC == 1
+    #define VTYPE float
+    #define VLOAD(o, p) (p)[o]
+    #elif VEC == 2
+    #define VTYPE float2
+    #define VLOAD(o, p) vload2(o, p)
+    #else
+    #define VTYPE float4
+    #define VLOAD(o, p) vload4(o, p)
+    #endif
+
+    __kernel __attribute__((reqd_work_group_size(WG_X, WG_Y, 1)))
+    void gemm_tuned( __global float  * i_a,
+                     __global float  * i_b,
+                     __global float4 * o_c,
+                     __private uint l_m,
+                     __private uint l_n,
+                     __private uint l_k ){
 
-static const char * l_gemm = R"(
-    __kernel void gemm( __global float4 * i_a,
-                        __global float4 * i_b,
-                        __global float4 * o_c,
-                        __private uint l_m,
-                        __private uint l_n,
-                        __private uint l_k ){
-
-        size_t l_gwid = get_global_id(0);
-        size_t l_gwid_x = l_gwid%(l_n/8);
-        size_t l_gwid_y = l_gwid/(l_n/8);
-        size_t l_start_m = l_gwid_y*4;
-        size_t l_start_n = l_gwid_x*2;
-        size_t l_a_start = l_gwid_x*4*l_k/4;
-        size_t l_b_start = l_gwid_x*8*l_k/4;
-        size_t l_c_start = l_start_m*l_n/4+l_start_n;       // 8 vector blocking
-
-        for(size_t m = 0; m < 4; m++){                      // m=4 in one block
-            for(size_t n = 0; n < 2; n++){                  // n=8 in one block with 4 elements per vector
-                for(size_t i = 0; i < l_k/4; i++){
-                    o_c[l_c_start+m*l_n/4+n].w += dot(i_a[l_a_start+i+m*l_k/4], i_b[l_b_start+i+n*4*l_k/4]);
-                    o_c[l_c_start+m*l_n/4+n].x += dot(i_a[l_a_start+i+m*l_k/4], i_b[l_b_start+i+n*4*l_k/4+1*l_k/4]);
-                    o_c[l_c_start+m*l_n/4+n].y += dot(i_a[l_a_start+i+m*l_k/4], i_b[l_b_start+i+n*4*l_k/4+2*l_k/4]);
-                    o_c[l_c_start+m*l_n/4+n].z += dot(i_a[l_a_start+i+m*l_k/4], i_b[l_b_start+i+n*4*l_k/4+3*l_k/4]);
-                }  
+        const size_t l_col = get_global_id(0)*TILE_N;       // first column of the block
+        const size_t l_row = get_global_id(1)*TILE_M;       // first row of the block
+
+        float4 l_acc[TILE_M][TILE_N/4];
+        for(size_t m = 0; m < TILE_M; m++){
+            for(size_t n = 0; n < TILE_N/4; n++){
+                l_acc[m][n] = (float4)(0.0f);
+            }
+        }
+
+    #if TILE_K > 0
+        __local float l_a_loc[WG_Y*TILE_M*TILE_K];
+        __local float l_b_loc[WG_X*TILE_N*TILE_K];
+
+        const size_t l_lid = get_local_id(1)*WG_X + get_local_id(0);
+        __global float * l_a_wg = i_a + get_group_id(1)*WG_Y*TILE_M*l_k;
+        __global float * l_b_wg = i_b + get_group_id(0)*WG_X*TILE_N*l_k;
+
+        __local float * l_a_blk = l_a_loc + get_local_id(1)*TILE_M*TILE_K;
+        __local float * l_b_blk = l_b_loc + get_local_id(0)*TILE_N*TILE_K;
+        const size_t l_ld = TILE_K;
+        const size_t l_kb_size = TILE_K;
+    #else
+        __global float * l_a_blk = i_a + l_row*l_k;
+        __global float * l_b_blk = i_b + l_col*l_k;
+        const size_t l_ld = l_k;
+        const size_t l_kb_size = l_k;
+    #endif
+
+        for(size_t l_kb = 0; l_kb < l_k; l_kb += l_kb_size){
+    #if TILE_K > 0
+            // cooperative load of the work group's slices of A and B
+            for(size_t l_id = l_lid; l_id < WG_Y*TILE_M*TILE_K; l_id += WG_X*WG_Y){
+                l_a_loc[l_id] = l_a_wg[(l_id/TILE_K)*l_k + l_kb + l_id%TILE_K];
+            }
+            for(size_t l_id = l_lid; l_id < WG_X*TILE_N*TILE_K; l_id += WG_X*WG_Y){
+                l_b_loc[l_id] = l_b_wg[(l_id/TILE_K)*l_k + l_kb + l_id%TILE_K];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+    #endif
+
+            for(size_t i = 0; i < l_kb_size; i += VEC){
+                VTYPE l_b_vec[TILE_N];
+                for(size_t n = 0; n < TILE_N; n++){
+                    l_b_vec[n] = VLOAD(0, l_b_blk + n*l_ld + i);
+                }
+                for(size_t m = 0; m < TILE_M; m++){
+                    VTYPE l_a_vec = VLOAD(0, l_a_blk + m*l_ld + i);
+                    for(size_t n = 0; n < TILE_N/4; n++){
+                        l_acc[m][n].w += dot(l_a_vec, l_b_vec[n*4+0]);
+                        l_acc[m][n].x += dot(l_a_vec, l_b_vec[n*4+1]);
+                        l_acc[m][n].y += dot(l_a_vec, l_b_vec[n*4+2]);
+                        l_acc[m][n].z += dot(l_a_vec, l_b_vec[n*4+3]);
+                    }
+                }
+            }
+
+    #if TILE_K > 0
+            barrier(CLK_LOCAL_MEM_FENCE);
+    #else
+            l_a_blk += l_kb_size;
+            l_b_blk += l_kb_size;
+    #endif
+        }
+
+        __global float4 * l_c = o_c + l_row*l_n/4 + l_col/4;
+        for(size_t m = 0; m < TILE_M; m++){
+            for(size_t n = 0; n < TILE_N/4; n++){
+                l_c[m*l_n/4+n] += l_acc[m][n];
             }
         }
     }
 )";
 
-int main(){
-    std::cout << "starting device query" << std::endl;
+// file in which tuned configurations are stored, one line per device and shape class
+static const char * l_gemm_tuning_file = "gemm_tuning.txt";
 
-    cl_int l_err = CL_SUCCESS;
+/**
+ * Configuration of the tunable gemm kernel, see l_gemm_tuned.
+ **/
+struct gemm_config {
+    std::size_t tile_m;
+    std::size_t tile_n;
+    std::size_t vec;
+    std::size_t tile_k;
+    std::size_t wg_x;
+    std::size_t wg_y;
+};
 
-    // number of platforms
-    cl_uint l_n_platforms = 0;
-    l_err = clGetPlatformIDs( 0, 
-                              NULL, 
-                              &l_n_platforms );
+// search space of the autotuner
+static const std::size_t l_tune_tile_m[] = { 1, 2, 4, 8 };
+static const std::size_t l_tune_tile_n[] = { 4, 8 };
+static const std::size_t l_tune_vec[]    = { 1, 2, 4 };
+static const std::size_t l_tune_tile_k[] = { 0, 8, 16, 32 };
+static const std::size_t l_tune_wg[][2]  = { {  1,  1 },
+                                             {  4,  4 },
+                                             {  8,  4 },
+                                             {  4,  8 },
+                                             {  8,  8 },
+                                             { 16,  4 },
+                                             { 16, 16 } };
+
+/**
+ * Returns the build options for a configuration of the tunable gemm kernel.
+ *
+ * @param i_config configuration.
+ * @return build options.
+ **/
+static std::string gemm_config_options( gemm_config const & i_config ){
+    std::string l_options = "";
+    l_options += " -D TILE_M=" + std::to_string(i_config.tile_m);
+    l_options += " -D TILE_N=" + std::to_string(i_config.tile_n);
+    l_options += " -D VEC="    + std::to_string(i_config.vec);
+    l_options += " -D TILE_K=" + std::to_string(i_config.tile_k);
+    l_options += " -D WG_X="   + std::to_string(i_config.wg_x);
+    l_options += " -D WG_Y="   + std::to_string(i_config.wg_y);
+    return l_options;
+}
+
+/**
+ * Checks if a configuration can be used for the given shape on the given device.
+ *
+ * @param i_device device on which the kernel runs.
+ * @param i_config configuration.
+ * @param i_m number of rows of A and C.
+ * @param i_n number of columns of B and C.
+ * @param i_k number of columns of A and rows of B.
+ * @return true if the configuration is valid, false otherwise.
+ **/
+static bool gemm_config_valid( cl_device_id        i_device,
+                               gemm_config const & i_config,
+                               std::size_t         i_m,
+                               std::size_t         i_n,
+                               std::size_t         i_k ){
+    if(    i_m % (i_config.tile_m*i_config.wg_y) != 0
+        || i_n % (i_config.tile_n*i_config.wg_x) != 0
+        || i_k % i_config.vec != 0 ){
+        return false;
+    }
+    if(    i_config.tile_k > 0
+        && (    i_k % i_config.tile_k != 0
+             || i_config.tile_k % i_config.vec != 0 ) ){
+        return false;
+    }
+
+    std::size_t l_max_wg_size = 0;
+    cl_int l_err = clGetDeviceInfo( i_device,
+                                    CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                    sizeof(l_max_wg_size),
+                                    &l_max_wg_size,
+                                    NULL );
     assert( l_err == CL_SUCCESS );
-    std::cout << "number of platforms: " << l_n_platforms << std::endl;
-    assert( l_n_platforms > 0);
+    if( i_config.wg_x*i_config.wg_y > l_max_wg_size ){
+        return false;
+    }
 
-    // platform IDs
-    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
-    l_err = clGetPlatformIDs( l_n_platforms, 
-                              l_platform_ids, 
-                              NULL);
+    cl_ulong l_local_mem_size = 0;
+    l_err = clGetDeviceInfo(    i_device,
+                                CL_DEVICE_LOCAL_MEM_SIZE,
+                                sizeof(l_local_mem_size),
+                                &l_local_mem_size,
+                                NULL );
     assert( l_err == CL_SUCCESS );
+    std::size_t l_local_mem_used = sizeof(cl_float) * i_config.tile_k * (   i_config.wg_y*i_config.tile_m
+                                                                           + i_config.wg_x*i_config.tile_n );
+    if( l_local_mem_used > l_local_mem_size ){
+        return false;
+    }
 
+    return true;
+}
+
+/**
+ * Returns a string which identifies the device and its driver.
+ *
+ * @param i_device device.
+ * @return identifier.
+ **/
+static std::string device_key( cl_device_id i_device ){
     cl_char l_tmp_string[8192] = {0};
+    std::string l_key = "";
 
-    // platform name
-    l_err = clGetPlatformInfo(  l_platform_ids[0], 
-                                CL_PLATFORM_NAME, 
-                                sizeof(l_tmp_string), 
-                                &l_tmp_string, 
-                                NULL );   
+    cl_int l_err = clGetDeviceInfo( i_device,
+                                    CL_DEVICE_NAME,
+                                    sizeof(l_tmp_string),
+                                    &l_tmp_string,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+    l_key += reinterpret_cast< char * >( l_tmp_string );
 
-    assert( l_err == CL_SUCCESS);
+    l_err = clGetDeviceInfo(    i_device,
+                                CL_DRIVER_VERSION,
+                                sizeof(l_tmp_string),
+                                &l_tmp_string,
+                                NULL );
+    assert( l_err == CL_SUCCESS );
+    l_key += " / ";
+    l_key += reinterpret_cast< char * >( l_tmp_string );
 
-    std::cout << "  CL_PLATFORM_NAME: " << l_tmp_string << std::endl;
+    // tabs separate the fields of the tuning file
+    std::replace( l_key.begin(), l_key.end(), '\t', ' ' );
 
-    // number of devices
-    cl_uint l_n_devices = 0;
-    l_err = clGetDeviceIDs( l_platform_ids[0],
-                            CL_DEVICE_TYPE_ALL,
-                            0, 
-                            NULL, 
-                            &l_n_devices );
-    assert( l_err == CL_SUCCESS );
+    return l_key;
+}
 
-    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
-    l_err = clGetDeviceIDs( l_platform_ids[0],
-                            CL_DEVICE_TYPE_ALL,
-                            l_n_devices,
-                            l_device_ids, 
-                            NULL );
+/**
+ * Returns the shape class of a matrix dimension: the next power of two.
+ *
+ * @param i_size dimension.
+ * @return shape class.
+ **/
+static std::size_t shape_class( std::size_t i_size ){
+    std::size_t l_class = 1;
+    while( l_class < i_size ){
+        l_class *= 2;
+    }
+    return l_class;
+}
+
+/**
+ * Looks up the tuned configuration for the device and the shape class of the given shape.
+ *
+ * @param i_device device on which the kernel runs.
+ * @param i_m number of rows of A and C.
+ * @param i_n number of columns of B and C.
+ * @param i_k number of columns of A and rows of B.
+ * @param o_config will be set to the tuned configuration.
+ * @return true if a configuration was found, false otherwise.
+ **/
+static bool load_gemm_tuning( cl_device_id  i_device,
+                              std::size_t   i_m,
+                              std::size_t   i_n,
+                              std::size_t   i_k,
+                              gemm_config & o_config ){
+    std::ifstream l_file( l_gemm_tuning_file );
+    if( !l_file ){
+        return false;
+    }
+
+    std::string l_device = device_key( i_device );
+    std::string l_line;
+    while( std::getline( l_file, l_line ) ){
+        std::istringstream l_stream( l_line );
+        std::string l_line_device;
+        std::string l_line_shape;
+        std::string l_line_config;
+        std::getline( l_stream, l_line_device, '\t' );
+        std::getline( l_stream, l_line_shape,  '\t' );
+        std::getline( l_stream, l_line_config, '\t' );
+
+        std::size_t l_m = 0, l_n = 0, l_k = 0;
+        std::istringstream( l_line_shape ) >> l_m >> l_n >> l_k;
+
+        if(    l_line_device == l_device
+            && l_m == shape_class(i_m)
+            && l_n == shape_class(i_n)
+            && l_k == shape_class(i_k) ){
+            std::istringstream l_config( l_line_config );
+            l_config >> o_config.tile_m >> o_config.tile_n >> o_config.vec
+                     >> o_config.tile_k >> o_config.wg_x   >> o_config.wg_y;
+            return !l_config.fail();
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Stores the tuned configuration for the device and shape class, replacing an existing entry.
+ *
+ * @param i_device device on which the kernel runs.
+ * @param i_m shape class of the rows of A and C.
+ * @param i_n shape class of the columns of B and C.
+ * @param i_k shape class of the columns of A and rows of B.
+ * @param i_config tuned configuration.
+ * @param i_gflops performance of the configuration.
+ **/
+static void store_gemm_tuning( cl_device_id        i_device,
+                               std::size_t         i_m,
+                               std::size_t         i_n,
+                               std::size_t         i_k,
+                               gemm_config const & i_config,
+                               double              i_gflops ){
+    std::string l_prefix = device_key( i_device ) + "\t"
+                         + std::to_string(i_m) + " " + std::to_string(i_n) + " " + std::to_string(i_k) + "\t";
+
+    // keep all entries of other devices and shape classes
+    std::vector< std::string > l_lines;
+    std::ifstream l_in( l_gemm_tuning_file );
+    std::string l_line;
+    while( std::getline( l_in, l_line ) ){
+        if( l_line.compare( 0, l_prefix.size(), l_prefix ) != 0 ){
+            l_lines.push_back( l_line );
+        }
+    }
+    l_in.close();
+
+    std::ostringstream l_entry;
+    l_entry << l_prefix
+            << i_config.tile_m << " " << i_config.tile_n << " " << i_config.vec << " "
+            << i_config.tile_k << " " << i_config.wg_x   << " " << i_config.wg_y << "\t"
+            << i_gflops;
+    l_lines.push_back( l_entry.str() );
+
+    std::ofstream l_out( l_gemm_tuning_file );
+    for( std::size_t l_li = 0; l_li < l_lines.size(); l_li++ ){
+        l_out << l_lines[l_li] << std::endl;
+    }
+}
+
+/**
+ * Builds the tunable gemm kernel for a configuration.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @param i_config configuration.
+ * @return kernel or NULL if the build failed or the work group size is not supported by the kernel.
+ **/
+static cl_kernel build_gemm_tuned_kernel( cl_context          i_context,
+                                          cl_device_id        i_device,
+                                          gemm_config const & i_config ){
+    cl_kernel l_kernel = build_kernel(  i_context,
+                                        i_device,
+                                        l_gemm_tuned,
+                                        "gemm_tuned",
+                                        gemm_config_options( i_config ) );
+    if( l_kernel == NULL ){
+        return NULL;
+    }
+
+    std::size_t l_kernel_wg_size = 0;
+    cl_int l_err = clGetKernelWorkGroupInfo(    l_kernel,
+                                                i_device,
+                                                CL_KERNEL_WORK_GROUP_SIZE,
+                                                sizeof(l_kernel_wg_size),
+                                                &l_kernel_wg_size,
+                                                NULL );
     assert( l_err == CL_SUCCESS );
+    if( i_config.wg_x*i_config.wg_y > l_kernel_wg_size ){
+        clReleaseKernel( l_kernel );
+        return NULL;
+    }
 
-    l_err = clGetDeviceInfo(    l_device_ids[0],
-                                CL_DEVICE_OPENCL_C_VERSION,
-                                sizeof(l_tmp_string),
-                                &l_tmp_string, 
-                                NULL );
+    return l_kernel;
+}
+
+// built tuned kernels per (context, device, build options of the configuration)
+static std::map< std::tuple< cl_context, cl_device_id, std::string >, cl_kernel > l_gemm_tuned_cache;
+
+/**
+ * Returns the tunable gemm kernel for a configuration.
+ * Kernels are built once and cached like the kernels of get_gemm_kernel, callers do not release them.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @param i_config configuration.
+ * @return kernel or NULL if the build failed or the work group size is not supported by the kernel.
+ **/
+static cl_kernel get_gemm_tuned_kernel( cl_context          i_context,
+                                        cl_device_id        i_device,
+                                        gemm_config const & i_config ){
+    std::tuple< cl_context, cl_device_id, std::string > l_key( i_context,
+                                                               i_device,
+                                                               gemm_config_options( i_config ) );
+    if( l_gemm_tuned_cache.count( l_key ) > 0 ){
+        return l_gemm_tuned_cache[l_key];
+    }
+
+    cl_kernel l_kernel = build_gemm_tuned_kernel(   i_context,
+                                                    i_device,
+                                                    i_config );
+    if( l_kernel != NULL ){
+        l_gemm_tuned_cache[l_key] = l_kernel;
+    }
+
+    return l_kernel;
+}
+
+/**
+ * Benchmarks all valid configurations of the tunable gemm kernel for the shape class of
+ * the given shape and stores the fastest one in the tuning file.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernels run.
+ * @param i_m number of rows of A and C.
+ * @param i_n number of columns of B and C.
+ * @param i_k number of columns of A and rows of B.
+ * @return 0 if a configuration was found, 1 otherwise.
+ **/
+static int tune_gemm( cl_context   i_context,
+                      cl_device_id i_device,
+                      std::size_t  i_m,
+                      std::size_t  i_n,
+                      std::size_t  i_k ){
+    cl_int l_err = CL_SUCCESS;
+    const std::size_t l_n_reps = 10;
+
+    // benchmark at the representative of the shape class
+    std::size_t l_m = shape_class( i_m );
+    std::size_t l_n = shape_class( i_n );
+    std::size_t l_k = shape_class( i_k );
+    std::cout << "tuning gemm for shape class m=" << l_m << " n=" << l_n << " k=" << l_k << std::endl;
+
+    // random A and B, C = 0, and a host reference to reject miscompiled variants
+    std::vector< cl_float > l_a_host( l_m*l_k );
+    std::vector< cl_float > l_b_host( l_k*l_n );
+    std::vector< cl_float4 > l_c_host( l_m*l_n/4 );
+    std::vector< cl_float > l_c_ref( l_m*l_n, 0 );
+    for( std::size_t l_en = 0; l_en < l_a_host.size(); l_en++ ){
+        l_a_host[l_en] = static_cast< cl_float >( std::rand() % 7 ) - 3;
+    }
+    for( std::size_t l_en = 0; l_en < l_b_host.size(); l_en++ ){
+        l_b_host[l_en] = static_cast< cl_float >( std::rand() % 7 ) - 3;
+    }
+    for( std::size_t l_row = 0; l_row < l_m; l_row++ ){
+        for( std::size_t l_col = 0; l_col < l_n; l_col++ ){
+            for( std::size_t l_id = 0; l_id < l_k; l_id++ ){
+                l_c_ref[l_row*l_n+l_col] += l_a_host[l_row*l_k+l_id] * l_b_host[l_col*l_k+l_id];
+            }
+        }
+    }
+
+    cl_mem l_a_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        sizeof(cl_float)*l_m*l_k,
+                                        l_a_host.data(),
+                                        &l_err );
     assert( l_err == CL_SUCCESS );
 
-    std::cout << "  CL_DEVICE_OPENCL_C_VERSION: " << l_tmp_string << std::endl;
+    cl_mem l_b_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                        sizeof(cl_float)*l_k*l_n,
+                                        l_b_host.data(),
+                                        &l_err );
+    assert( l_err == CL_SUCCESS );
 
-    /*
-     * prepare program execution
-     */
-    cl_context l_context = clCreateContext( NULL,
-                                            1,
-                                            l_device_ids+0,
-                                            NULL,
-                                            NULL,
-                                            &l_err );
+    cl_mem l_c_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_WRITE,
+                                        sizeof(cl_float4)*l_m*l_n/4,
+                                        NULL,
+                                        &l_err );
     assert( l_err == CL_SUCCESS );
 
-    cl_program l_program = clCreateProgramWithSource(   l_context,
-                                                        1,
-                                                        &l_gemm,
-                                                        NULL,
+    cl_command_queue l_queue = clCreateCommandQueue(    i_context,
+                                                        i_device,
+                                                        CL_QUEUE_PROFILING_ENABLE,
                                                         &l_err );
     assert( l_err == CL_SUCCESS );
 
-    /*
-     * build program 
-     */
-    std::cout << "build program: " << std::endl;
-    std::cout << l_gemm << std::endl;
-    l_err = clBuildProgram( l_program,
-                            0,
-                            NULL,
-                            NULL,
-                            NULL,
-                            NULL);
+    cl_uint l_args[3] = { static_cast<cl_uint>(l_m),
+                          static_cast<cl_uint>(l_n),
+                          static_cast<cl_uint>(l_k) };
 
-    if ( l_err != CL_SUCCESS )
-    {
-        std::cerr << "failed to build program!" << std::endl;
+    bool l_found = false;
+    gemm_config l_best = { 0, 0, 0, 0, 0, 0 };
+    double l_best_time = 0;
 
-        clGetProgramBuildInfo(  l_program,
-                                l_device_ids[0],
-                                CL_PROGRAM_BUILD_LOG,
-                                sizeof(l_tmp_string),
-                                l_tmp_string,
-                                NULL );
-        std::cerr << l_tmp_string << std::endl;
+    for( std::size_t l_tm : l_tune_tile_m )
+    for( std::size_t l_tn : l_tune_tile_n )
+    for( std::size_t l_ve : l_tune_vec )
+    for( std::size_t l_tk : l_tune_tile_k )
+    for( std::size_t l_wg = 0; l_wg < sizeof(l_tune_wg)/sizeof(l_tune_wg[0]); l_wg++ ){
+        gemm_config l_config = { l_tm, l_tn, l_ve, l_tk, l_tune_wg[l_wg][0], l_tune_wg[l_wg][1] };
+        if( !gemm_config_valid( i_device, l_config, l_m, l_n, l_k ) ){
+            continue;
+        }
+
+        cl_kernel l_kernel = build_gemm_tuned_kernel( i_context,
+                                                      i_device,
+                                                      l_config );
+        if( l_kernel == NULL ){
+            continue;
+        }
+
+        l_err  = clSetKernelArg( l_kernel, 0, sizeof(cl_mem),  &l_a_device );
+        l_err |= clSetKernelArg( l_kernel, 1, sizeof(cl_mem),  &l_b_device );
+        l_err |= clSetKernelArg( l_kernel, 2, sizeof(cl_mem),  &l_c_device );
+        l_err |= clSetKernelArg( l_kernel, 3, sizeof(cl_uint), l_args+0 );
+        l_err |= clSetKernelArg( l_kernel, 4, sizeof(cl_uint), l_args+1 );
+        l_err |= clSetKernelArg( l_kernel, 5, sizeof(cl_uint), l_args+2 );
+        assert( l_err == CL_SUCCESS );
+
+        std::size_t l_global_size[2] = { l_n/l_config.tile_n, l_m/l_config.tile_m };
+        std::size_t l_local_size[2]  = { l_config.wg_x, l_config.wg_y };
+
+        // correctness run on C = 0
+        std::fill( l_c_host.begin(), l_c_host.end(), cl_float4{ { 0, 0, 0, 0 } } );
+        l_err = clEnqueueWriteBuffer(   l_queue,
+                                        l_c_device,
+                                        CL_TRUE,
+                                        0,
+                                        sizeof(cl_float4)*l_m*l_n/4,
+                                        l_c_host.data(),
+                                        0,
+                                        NULL,
+                                        NULL );
+        assert( l_err == CL_SUCCESS );
+
+        l_err = clEnqueueNDRangeKernel( l_queue,
+                                        l_kernel,
+                                        2,
+                                        NULL,
+                                        l_global_size,
+                                        l_local_size,
+                                        0,
+                                        NULL,
+                                        NULL );
+        if( l_err != CL_SUCCESS ){
+            clReleaseKernel( l_kernel );
+            continue;
+        }
+
+        l_err = clEnqueueReadBuffer(    l_queue,
+                                        l_c_device,
+                                        CL_TRUE,
+                                        0,
+                                        sizeof(cl_float4)*l_m*l_n/4,
+                                        l_c_host.data(),
+                                        0,
+                                        NULL,
+                                        NULL );
+        assert( l_err == CL_SUCCESS );
+
+        // .w, .x, .y, .z hold four consecutive columns of C
+        bool l_correct = true;
+        for( std::size_t l_en = 0; l_en < l_m*l_n/4; l_en++ ){
+            cl_float * l_ref = l_c_ref.data() + l_en*4;
+            if(    l_c_host[l_en].w != l_ref[0] || l_c_host[l_en].x != l_ref[1]
+                || l_c_host[l_en].y != l_ref[2] || l_c_host[l_en].z != l_ref[3] ){
+                l_correct = false;
+            }
+        }
+        if( !l_correct ){
+            std::cerr << "  wrong result for" << gemm_config_options( l_config ) << std::endl;
+            clReleaseKernel( l_kernel );
+            continue;
+        }
+
+        // timed runs, the fastest one counts
+        double l_time = 0;
+        for( std::size_t l_re = 0; l_re < l_n_reps; l_re++ ){
+            cl_event l_event;
+            l_err = clEnqueueNDRangeKernel( l_queue,
+                                            l_kernel,
+                                            2,
+                                            NULL,
+                                            l_global_size,
+                                            l_local_size,
+                                            0,
+                                            NULL,
+                                            &l_event );
+            assert( l_err == CL_SUCCESS );
+            l_err = clWaitForEvents( 1, &l_event );
+            assert( l_err == CL_SUCCESS );
+
+            cl_ulong l_start = 0;
+            cl_ulong l_end = 0;
+            l_err  = clGetEventProfilingInfo( l_event, CL_PROFILING_COMMAND_START, sizeof(l_start), &l_start, NULL );
+            l_err |= clGetEventProfilingInfo( l_event, CL_PROFILING_COMMAND_END,   sizeof(l_end),   &l_end,   NULL );
+            assert( l_err == CL_SUCCESS );
+            clReleaseEvent( l_event );
+
+            double l_time_re = (l_end - l_start) * 1.0E-9;
+            if( l_re == 0 || l_time_re < l_time ){
+                l_time = l_time_re;
+            }
+        }
+        clReleaseKernel( l_kernel );
+
+        std::cout << "  " << gemm_config_options( l_config ) << ": "
+                  << 2.0E-9*l_m*l_n*l_k / l_time << " GFLOPS" << std::endl;
+
+        if( !l_found || l_time < l_best_time ){
+            l_found = true;
+            l_best = l_config;
+            l_best_time = l_time;
+        }
+    }
+
+    clReleaseCommandQueue( l_queue );
+    clReleaseMemObject( l_a_device );
+    clReleaseMemObject( l_b_device );
+    clReleaseMemObject( l_c_device );
+
+    if( !l_found ){
+        std::cerr << "no valid gemm configuration found" << std::endl;
         return 1;
-    }else{
-        std::cout << "successfully build program" << std::endl;
     }
-    
-    // create kernel
-    cl_kernel l_gemm = clCreateKernel(  l_program,
-                                        "gemm",
-                                        &l_err );
-    assert( l_err == CL_SUCCESS ); 
+
+    double l_gflops = 2.0E-9*l_m*l_n*l_k / l_best_time;
+    std::cout << "best configuration:" << gemm_config_options( l_best ) << " with " << l_gflops << " GFLOPS" << std::endl;
+    store_gemm_tuning( i_device,
+                       l_m,
+                       l_n,
+                       l_k,
+                       l_best,
+                       l_gflops );
+
+    return 0;
+}
+
+/**
+ * Kernel and NDRange of a gemm launch.
+ **/
+struct gemm_launch {
+    cl_kernel   kernel;
+    cl_uint     work_dim;
+    std::size_t global_size[2];
+    std::size_t local_size[2];
+    bool        use_local_size;
+};
+
+/**
+ * Selects the gemm kernel for the given element type and shape: the tuned kernel if
+ * the device was tuned for the shape class, otherwise the gemm kernel, specialized
+ * for the shape if available. Kernels are cached, the caller does not release them.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @param i_m number of rows of A and C.
+ * @param i_n number of columns of B and C.
+ * @param i_k number of columns of A and rows of B.
+ * @param o_launch will be set to the kernel and its NDRange.
+ * @return true on success, false if the kernel could not be built.
+ **/
+template< typename T >
+bool select_gemm_kernel( cl_context    i_context,
+                         cl_device_id  i_device,
+                         std::size_t   i_m,
+                         std::size_t   i_n,
+                         std::size_t   i_k,
+                         gemm_launch & o_launch ){
+    o_launch.kernel = NULL;
+    o_launch.local_size[0] = 1;
+    o_launch.local_size[1] = 1;
+
+    // tuned kernels exist only for float
+    gemm_config l_config;
+    if(    std::is_same< T, cl_float >::value
+        && load_gemm_tuning( i_device, i_m, i_n, i_k, l_config )
+        && gemm_config_valid( i_device, l_config, i_m, i_n, i_k ) ){
+        std::cout << "using tuned gemm kernel:" << gemm_config_options( l_config ) << std::endl;
+        o_launch.kernel = get_gemm_tuned_kernel(   i_context,
+                                                   i_device,
+                                                   l_config );
+        o_launch.work_dim = 2;
+        o_launch.global_size[0] = i_n/l_config.tile_n;
+        o_launch.global_size[1] = i_m/l_config.tile_m;
+        o_launch.local_size[0] = l_config.wg_x;
+        o_launch.local_size[1] = l_config.wg_y;
+        o_launch.use_local_size = true;
+    }
+    if( o_launch.kernel == NULL ){
+        o_launch.kernel = get_gemm_kernel< T >( i_context,
+                                                i_device,
+                                                i_m,
+                                                i_n,
+                                                i_k );
+        o_launch.work_dim = 1;
+        o_launch.global_size[0] = i_m/4*i_n/8;          // l_m/4*l_n/8 threads!
+        o_launch.global_size[1] = 1;
+        o_launch.use_local_size = false;
+    }
+
+    return o_launch.kernel != NULL;
+}
+
+/**
+ * Runs the gemm kernel for the given element type.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @param i_abft if true, C is verified with row and column checksums.
+ * @param i_inject if true, a fault is injected into C before the verification, which has to locate it.
+ * @return 0 on success, 1 if the kernel could not be built, the checksums do not match or an injected fault is not located.
+ **/
+template< typename T >
+int run_gemm( cl_context   i_context,
+              cl_device_id i_device,
+              bool         i_abft,
+              bool         i_inject ){
+    typedef element_type< T > elem;
+    typedef typename elem::vec4 vec4;
+    cl_int l_err = CL_SUCCESS;
 
     // allocate  host memory
     std::cout << "allocating host memory" << std::endl;
@@ -155,151 +742,156 @@ int main(){
     std::size_t l_m = dataSize*4;
     std::size_t l_n = dataSize*8;
     std::size_t l_k = dataSize*8;
-    std::size_t global_work_size = dataSize*dataSize;   // how many threads? l_m/4*l_n/8 threads!
+
+    // the checksum kernels are built here, outside the timed region
+    gemm_launch l_launch;
+    abft_state l_abft;
+    if(    !select_gemm_kernel< T >( i_context,
+                                     i_device,
+                                     l_m,
+                                     l_n,
+                                     l_k,
+                                     l_launch )
+        || ( i_abft && !abft_build< T >( i_context,
+                                         i_device,
+                                         l_abft ) ) ){
+        return 1;
+    }
+    cl_kernel l_gemm = l_launch.kernel;
+    std::cout << "successfully build program" << std::endl;
     
-    cl_float4* l_a_host = new cl_float4[l_m*l_k/4];
-    cl_float4* l_b_host = new cl_float4[l_n*l_k/4];
-    cl_float4* l_c_host = new cl_float4[l_m*l_n/4];
+    // inputs in standard layout: A row-major (m, k), B row-major (k, n)
+    T* l_a_in = new T[l_m*l_k];
+    T* l_b_in = new T[l_k*l_n];
+
+    // inputs in the kernel's layout, first touched by the packing threads
+    vec4* l_a_host = new vec4[l_m*l_k/4];
+    vec4* l_b_host = new vec4[l_n*l_k/4];
+    vec4* l_c_host = new vec4[l_m*l_n/4];
 
     // initialize host memory
     std::cout << "initializing host memory" << std::endl;
 
-    // array A[k]
+    // array A
     //         k -->
-    //     |||---------------|----------------|||
-    // m   |||0  4   8   12  |16   20  24  28 |||
-    // |   |||---------------|----------------|||
-    // v   |||1  5   9   13  |17   21  25  29 |||
-    //     |||---------------|----------------|||
-    //     |||2  6   10  14  |18   22  26  30 |||
-    //     |||---------------|----------------|||
-    //     |||3  7   11  15  |19   23  27  31 |||
-    //     |||---------------|----------------|||
+    //     |---------------|----------------|
+    // m   |0  4   8   12  |16   20  24  28 |
+    // |   |---------------|----------------|
+    // v   |1  5   9   13  |17   21  25  29 |
+    //     |---------------|----------------|
+    //     |2  6   10  14  |18   22  26  30 |
+    //     |---------------|----------------|
+    //     |3  7   11  15  |19   23  27  31 |
+    //     |---------------|----------------|
     for (std::size_t i = 0; i < l_m; i++)
     {
-        for (std::size_t j = 0; j < l_k/4; j++)
+        for (std::size_t j = 0; j < l_k; j++)
         {
-            l_a_host[i*l_k/4+j].w = j*4*l_m+i;
-            l_a_host[i*l_k/4+j].x = j*4*l_m+i+l_m;
-            l_a_host[i*l_k/4+j].y = j*4*l_m+i+2*l_m;
-            l_a_host[i*l_k/4+j].z = j*4*l_m+i+3*l_m;
+            l_a_in[i*l_k+j] = elem::to_elem( j*l_m+i );
         }
     }
     std::cout << "initialization of A completed!" << std::endl;
 
     // test print array A
-    std::cout << "print array A in float4 data type:" << std::endl;
+    std::cout << "print array A:" << std::endl;
     for (std::size_t i = 0; i < l_m; i++)
     {
-        for (std::size_t j = 0; j < l_k/4; j++)
+        for (std::size_t j = 0; j < l_k; j++)
         {
-            std::cout << l_a_host[i*l_k/4+j].w << "\t" << l_a_host[i*l_k/4+j].x << "\t" << l_a_host[i*l_k/4+j].y << "\t" << l_a_host[i*l_k/4+j].z << "\t";
+            std::cout << elem::to_double( l_a_in[i*l_k+j] ) << "\t";
         }
         std::cout << std::endl;
     }
-    
-    // std::cout << "printing of A completed!" << std::endl;
 
-    // array B[k]
+    // array B
     //     n -->
-    //     |||-  ||-  ||-  ||-  |||
-    //     |||-  ||-  ||-  ||-  |||
-    // k   |||0  ||24 ||48 ||72 |||
-    // |   |||3  ||27 ||51 ||75 |||
-    // v   |||6  ||30 ||54 ||78 |||
-    //     |||9  ||33 ||57 ||81 |||
-    //     |||-  ||-  ||-  ||-  |||
-    //     |||12 ||36 ||60 ||84 |||
-    //     |||15 ||39 ||63 ||87 |||
-    //     |||18 ||42 ||66 ||90 |||
-    //     |||21 ||45 ||69 ||93 |||
-    //     |||-  ||-  ||-  ||-  |||
-
-    for (std::size_t i = 0; i < l_n; i++)
+    //     |-  |-  |-  |-  |
+    //     |-  |-  |-  |-  |
+    // k   |0  |8  |16 |24 |
+    // |   |1  |9  |17 |25 |
+    // v   |2  |10 |18 |26 |
+    //     |3  |11 |19 |27 |
+    //     |-  |-  |-  |-  |
+    //     |4  |12 |20 |28 |
+    //     |5  |13 |21 |29 |
+    //     |6  |14 |22 |30 |
+    //     |7  |15 |23 |31 |
+    //     |-  |-  |-  |-  |
+    for (std::size_t i = 0; i < l_k; i++)
     {
-        for (std::size_t j = 0; j < l_k/4; j++)
+        for (std::size_t j = 0; j < l_n; j++)
         {
-            l_b_host[i*l_k/4+j].w = (i*l_k+j*4);
-            l_b_host[i*l_k/4+j].x = (i*l_k+j*4+1);
-            l_b_host[i*l_k/4+j].y = (i*l_k+j*4+2);
-            l_b_host[i*l_k/4+j].z = (i*l_k+j*4+3);
+            l_b_in[i*l_n+j] = elem::to_elem( j*l_k+i );
         }
     }
     std::cout << "initialization of B completed!" << std::endl;
 
     // test print array B
-    std::cout << "print array B in float4 data type:" << std::endl;
-    for (std::size_t i = 0; i < l_k/4; i++)
+    std::cout << "print array B:" << std::endl;
+    for (std::size_t i = 0; i < l_k; i++)
     {
         for (std::size_t j = 0; j < l_n; j++)
         {
-            std::cout << l_b_host[i+j*l_k/4].w << "\t";
-        }
-        std::cout << std::endl;
-        for (std::size_t j = 0; j < l_n; j++)
-        {
-            std::cout << l_b_host[i+j*l_k/4].x << "\t";
-        }
-        std::cout << std::endl;
-        for (std::size_t j = 0; j < l_n; j++)
-        {
-            std::cout << l_b_host[i+j*l_k/4].y << "\t";
-        }
-        std::cout << std::endl;
-        for (std::size_t j = 0; j < l_n; j++)
-        {
-            std::cout << l_b_host[i+j*l_k/4].z << "\t";
+            std::cout << elem::to_double( l_b_in[i*l_n+j] ) << "\t";
         }
         std::cout << std::endl;
     }
 
-    // array C
-    for (std::size_t i = 0; i < l_m*l_n/4; i++)
-    {
-        l_c_host[i].w = -1;
-        l_c_host[i].x = -1;
-        l_c_host[i].y = -1;
-        l_c_host[i].z = -1;
-    }
-    std::cout << "initialization of C completed!" << std::endl;
-
-    // test print array C
-    // std::cout << "print array C in float4 data type:" << std::endl;
-    // for (std::size_t i = 0; i < l_m; i++)
-    // {
-    //     for (std::size_t j = 0; j < l_n/4; j++)
-    //     {
-    //         std::cout << l_c_host[i*l_n/4+j].w << "\t" << l_c_host[i*l_n/4+j].x << "\t" << l_c_host[i*l_n/4+j].y << "\t" << l_c_host[i*l_n/4+j].z << "\t";
-    //     }
-    //     std::cout << std::endl;
-    // }
+    // pack A, B and C = -1 into the kernel's layout
+    std::cout << "packing host memory" << std::endl;
+    thread_pool l_pool;
+    std::chrono::steady_clock::time_point l_tp0 = std::chrono::steady_clock::now();
+    pack_a( l_pool,
+            l_a_in,
+            false,
+            l_m,
+            l_k,
+            reinterpret_cast< T * >( l_a_host ) );
+    pack_b( l_pool,
+            l_b_in,
+            false,
+            l_k,
+            l_n,
+            reinterpret_cast< T * >( l_b_host ) );
+    pack_c( l_pool,
+            static_cast< const T * >( NULL ),
+            elem::to_elem( -1 ),
+            l_m,
+            l_n,
+            reinterpret_cast< T * >( l_c_host ) );
+    std::chrono::steady_clock::time_point l_tp1 = std::chrono::steady_clock::now();
+
+    double l_time_pack = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp1 - l_tp0 ).count();
+    double l_bytes_pack = sizeof(T) * ( 2*l_m*l_k + 2*l_k*l_n + l_m*l_n );
+    std::cout << "packing completed with " << l_pool.size() << " threads: " << l_time_pack << " s, "
+              << 1.0E-9 * l_bytes_pack / l_time_pack << " GB/s" << std::endl;
 
     std::cout << "allocation device memory" << std::endl;
 
-    cl_mem l_a_device = clCreateBuffer( l_context,
+    cl_mem l_a_device = clCreateBuffer( i_context,
                                         CL_MEM_READ_ONLY, 
-                                        sizeof(cl_float4)*l_m*l_k/4, 
+                                        sizeof(vec4)*l_m*l_k/4, 
                                         NULL, 
                                         &l_err );
     assert( l_err == CL_SUCCESS ); 
 
-    cl_mem l_b_device = clCreateBuffer( l_context,
+    cl_mem l_b_device = clCreateBuffer( i_context,
                                         CL_MEM_READ_ONLY, 
-                                        sizeof(cl_float4)*l_k/4*l_n, 
+                                        sizeof(vec4)*l_k/4*l_n, 
                                         NULL, 
                                         &l_err );
     assert( l_err == CL_SUCCESS ); 
 
-    cl_mem l_c_device = clCreateBuffer( l_context,
-                                        CL_MEM_WRITE_ONLY, 
-                                        sizeof(cl_float4)*l_m*l_n/4, 
+    cl_mem l_c_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_WRITE, 
+                                        sizeof(vec4)*l_m*l_n/4, 
                                         NULL, 
                                         &l_err );
     assert( l_err == CL_SUCCESS );
 
     // command queue
-    cl_command_queue l_queue = clCreateCommandQueue(    l_context, 
-                                                        l_device_ids[0], 
+    cl_command_queue l_queue = clCreateCommandQueue(    i_context, 
+                                                        i_device, 
                                                         0, 
                                                         &l_err );
 
@@ -309,7 +901,7 @@ int main(){
                                     l_a_device,
                                     CL_TRUE,
                                     0,
-                                    sizeof(cl_float4)*l_k/4*l_m,
+                                    sizeof(vec4)*l_k/4*l_m,
                                     l_a_host,
                                     0,
                                     NULL,
@@ -320,7 +912,7 @@ int main(){
                                     l_b_device,
                                     CL_TRUE,
                                     0,
-                                    sizeof(cl_float4)*l_k/4*l_n,
+                                    sizeof(vec4)*l_k/4*l_n,
                                     l_b_host,
                                     0,
                                     NULL,
@@ -331,13 +923,30 @@ int main(){
                                     l_c_device,
                                     CL_TRUE,
                                     0,
-                                    sizeof(cl_float4)*l_n/4*l_m,
+                                    sizeof(vec4)*l_n/4*l_m,
                                     l_c_host,
                                     0,
                                     NULL,
                                     NULL );
     assert( l_err == CL_SUCCESS );
 
+    // checksums of C += A*B, enqueued before the gemm since they start from the input C
+    double l_time_abft = 0;
+    if( i_abft ){
+        std::chrono::steady_clock::time_point l_tp_abft = std::chrono::steady_clock::now();
+        abft_encode< T >( i_context,
+                          l_queue,
+                          l_a_device,
+                          l_b_device,
+                          l_c_device,
+                          l_m,
+                          l_n,
+                          l_k,
+                          l_abft );
+        l_err = clFinish( l_queue );
+        assert( l_err == CL_SUCCESS );
+        l_time_abft = std::chrono::duration_cast< std::chrono::duration< double > >( std::chrono::steady_clock::now() - l_tp_abft ).count();
+    }
 
     // run kernel
     std::cout << "setting kernel parameters" << std::endl;
@@ -381,12 +990,13 @@ int main(){
     assert( l_err == CL_SUCCESS );
     
     std::cout << "running kernel" << std::endl;
+    std::chrono::steady_clock::time_point l_tp2 = std::chrono::steady_clock::now();
     l_err = clEnqueueNDRangeKernel( l_queue,
                                     l_gemm,
-                                    1,
-                                    NULL,
-                                    &global_work_size,
+                                    l_launch.work_dim,
                                     NULL,
+                                    l_launch.global_size,
+                                    l_launch.use_local_size ? l_launch.local_size : NULL,
                                     0,
                                     NULL,
                                     NULL);
@@ -395,7 +1005,43 @@ int main(){
     l_err = clFinish( l_queue );
     assert( l_err == CL_SUCCESS );
 
+    std::chrono::steady_clock::time_point l_tp3 = std::chrono::steady_clock::now();
+
     std::cout << "successfully finished queue" << std::endl;
+    double l_time_gemm = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp3 - l_tp2 ).count();
+    std::cout << "kernel: " << l_time_gemm << " s, " << 2.0E-9 * l_m*l_n*l_k / l_time_gemm << " GFLOPS"
+              << ", packing: " << l_time_pack << " s" << std::endl;
+
+    // verify C on the device
+    bool l_verified = true;
+    if( i_abft ){
+        std::size_t l_fault_row = 0;
+        std::size_t l_fault_col = 0;
+        if( i_inject ){
+            abft_inject< T >( l_queue,
+                              l_c_device,
+                              l_abft,
+                              l_fault_row,
+                              l_fault_col );
+        }
+
+        std::chrono::steady_clock::time_point l_tp_abft = std::chrono::steady_clock::now();
+        abft_report l_report;
+        l_verified = abft_verify( l_queue,
+                                  l_c_device,
+                                  l_abft,
+                                  l_report );
+        l_time_abft += std::chrono::duration_cast< std::chrono::duration< double > >( std::chrono::steady_clock::now() - l_tp_abft ).count();
+        print_abft_report( l_report );
+        std::cout << "abft: " << l_time_abft << " s for " << 100.0 * abft_flop_ratio( l_m, l_n ) << " % extra flops" << std::endl;
+        abft_release( l_abft );
+
+        if( i_inject ){
+            l_verified = abft_located( l_report, l_fault_row, l_fault_col );
+            std::cout << "abft: fault injected at row " << l_fault_row << ", column " << l_fault_col
+                      << ( l_verified ? " was located" : " was not located" ) << std::endl;
+        }
+    }
 
     // device host transfer
     std::cout << "copying data from device to host" << std::endl;
@@ -403,7 +1049,7 @@ int main(){
                                 l_c_device, 
                                 CL_TRUE, 
                                 0, 
-                                sizeof(cl_float4)*l_n/4*l_m, 
+                                sizeof(vec4)*l_n/4*l_m, 
                                 l_c_host, 
                                 0, 
                                 NULL, 
@@ -419,18 +1065,448 @@ int main(){
     {
         for (std::size_t j = 0; j < l_n/4; j++)
         {
-            std::cout << l_c_host[i*l_n/4+j].w << "\t" << l_c_host[i*l_n/4+j].x << "\t" << l_c_host[i*l_n/4+j].y << "\t" << l_c_host[i*l_n/4+j].z << "\t";
+            std::cout << elem::to_double( l_c_host[i*l_n/4+j].w ) << "\t" << elem::to_double( l_c_host[i*l_n/4+j].x ) << "\t" << elem::to_double( l_c_host[i*l_n/4+j].y ) << "\t" << elem::to_double( l_c_host[i*l_n/4+j].z ) << "\t";
         }
         std::cout << std::endl;
     }
 
 
+    delete [] l_a_in;
+    delete [] l_b_in;
     delete [] l_a_host;
     delete [] l_b_host;
     delete [] l_c_host;
 
+    return l_verified ? 0 : 1;
+}
+
+/**
+ * Runs the gemm kernel on matrices stored in .npy files.
+ * A is read in C order (m, k), B in Fortran order (k, n), the optional input C and
+ * the result C = C + A*B are in C order (m, n). All files use the element type's dtype.
+ * Files are memory mapped and streamed directly into and out of host accessible device buffers.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @param i_a_path path of A.
+ * @param i_b_path path of B.
+ * @param i_c_path path of the result.
+ * @param i_c_in_path path of the input C, NULL to start from C = 0.
+ * @param i_abft if true, C is verified with row and column checksums before it is written.
+ * @param i_inject if true, a fault is injected into C before the verification, which has to locate it.
+ * @return 0 on success, 1 otherwise.
+ **/
+template< typename T >
+int run_gemm_files( cl_context   i_context,
+                    cl_device_id i_device,
+                    const char * i_a_path,
+                    const char * i_b_path,
+                    const char * i_c_path,
+                    const char * i_c_in_path,
+                    bool         i_abft,
+                    bool         i_inject ){
+    typedef element_type< T > elem;
+    cl_int l_err = CL_SUCCESS;
+
+    npy_file l_a;
+    npy_file l_b;
+    npy_file l_c_in;
+    if( !npy_open( i_a_path, l_a ) ){
+        return 1;
+    }
+    if( !npy_open( i_b_path, l_b ) ){
+        npy_close( l_a );
+        return 1;
+    }
+    if( i_c_in_path != NULL && !npy_open( i_c_in_path, l_c_in ) ){
+        npy_close( l_a );
+        npy_close( l_b );
+        return 1;
+    }
+
+    // check dtypes, layouts and shapes
+    bool l_valid =    l_a.descr == elem::npy_descr()
+                   && l_b.descr == elem::npy_descr()
+                   && l_a.shape.size() == 2
+                   && l_b.shape.size() == 2
+                   && !l_a.fortran_order
+                   && l_b.fortran_order
+                   && l_a.shape[1] == l_b.shape[0];
+    std::size_t l_m = l_valid ? l_a.shape[0] : 0;
+    std::size_t l_n = l_valid ? l_b.shape[1] : 0;
+    std::size_t l_k = l_valid ? l_a.shape[1] : 0;
+    l_valid = l_valid && l_m % 4 == 0 && l_n % 8 == 0 && l_k % 4 == 0;
+    if( i_c_in_path != NULL ){
+        l_valid =    l_valid
+                  && l_c_in.descr == elem::npy_descr()
+                  && !l_c_in.fortran_order
+                  && l_c_in.shape.size() == 2
+                  && l_c_in.shape[0] == l_m
+                  && l_c_in.shape[1] == l_n;
+    }
+    if( !l_valid ){
+        std::cerr << "expected " << elem::npy_descr() << " matrices A (m, k) in C order, B (k, n) in Fortran order"
+                  << " and C (m, n) in C order with m%4 == 0, n%8 == 0 and k%4 == 0" << std::endl;
+        npy_close( l_a );
+        npy_close( l_b );
+        if( i_c_in_path != NULL ){
+            npy_close( l_c_in );
+        }
+        return 1;
+    }
+    std::cout << "gemm from files with m=" << l_m << " n=" << l_n << " k=" << l_k << std::endl;
+
+    // the checksum kernels are built here, outside the timed regions
+    gemm_launch l_launch;
+    abft_state l_abft;
+    if(    !select_gemm_kernel< T >( i_context,
+                                     i_device,
+                                     l_m,
+                                     l_n,
+                                     l_k,
+                                     l_launch )
+        || ( i_abft && !abft_build< T >( i_context,
+                                         i_device,
+                                         l_abft ) ) ){
+        npy_close( l_a );
+        npy_close( l_b );
+        if( i_c_in_path != NULL ){
+            npy_close( l_c_in );
+        }
+        return 1;
+    }
+
+    cl_command_queue l_queue = clCreateCommandQueue(    i_context,
+                                                        i_device,
+                                                        0,
+                                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    // host accessible device buffers, mapping them does not copy
+    cl_mem l_a_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                        sizeof(T)*l_m*l_k,
+                                        NULL,
+                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_mem l_b_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                                        sizeof(T)*l_k*l_n,
+                                        NULL,
+                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_mem l_c_device = clCreateBuffer( i_context,
+                                        CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                        sizeof(T)*l_m*l_n,
+                                        NULL,
+                                        &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    // stream the operands, C is converted to the kernel's column order
+    // only this section is timed: file pages are faulted in by the copies, kernels are already built
+    std::cout << "streaming matrices from files to device" << std::endl;
+    std::chrono::steady_clock::time_point l_tp0 = std::chrono::steady_clock::now();
+    bool l_ok = npy_to_buffer( l_queue, l_a, l_a_device, 0 );
+    l_ok = l_ok && npy_to_buffer( l_queue, l_b, l_b_device, 0 );
+    if( i_c_in_path != NULL ){
+        l_ok = l_ok && npy_to_buffer( l_queue, l_c_in, l_c_device, 1 );
+        npy_close( l_c_in );
+    }
+    else{
+        T l_zero = elem::to_elem( 0 );
+        l_err = clEnqueueFillBuffer(    l_queue,
+                                        l_c_device,
+                                        &l_zero,
+                                        sizeof(T),
+                                        0,
+                                        sizeof(T)*l_m*l_n,
+                                        0,
+                                        NULL,
+                                        NULL );
+        assert( l_err == CL_SUCCESS );
+    }
+    npy_close( l_a );
+    npy_close( l_b );
+    if( !l_ok ){
+        return 1;
+    }
+
+    l_err = clFinish( l_queue );
+    assert( l_err == CL_SUCCESS );
+    std::chrono::steady_clock::time_point l_tp1 = std::chrono::steady_clock::now();
+
+    // checksums of C += A*B, enqueued before the gemm since they start from the input C
+    if( i_abft ){
+        abft_encode< T >( i_context,
+                          l_queue,
+                          l_a_device,
+                          l_b_device,
+                          l_c_device,
+                          l_m,
+                          l_n,
+                          l_k,
+                          l_abft );
+        l_err = clFinish( l_queue );
+        assert( l_err == CL_SUCCESS );
+    }
+    std::chrono::steady_clock::time_point l_tp_gemm = std::chrono::steady_clock::now();
+
+    // run kernel
+    cl_mem l_buffers[3] = { l_a_device, l_b_device, l_c_device };
+    cl_uint l_args[3] = { static_cast<cl_uint>(l_m),
+                          static_cast<cl_uint>(l_n),
+                          static_cast<cl_uint>(l_k) };
+    for( cl_uint l_ar = 0; l_ar < 3; l_ar++ ){
+        l_err = clSetKernelArg( l_launch.kernel,
+                                l_ar,
+                                sizeof(cl_mem),
+                                l_buffers+l_ar );
+        assert( l_err == CL_SUCCESS );
+
+        l_err = clSetKernelArg( l_launch.kernel,
+                                3+l_ar,
+                                sizeof(cl_uint),
+                                l_args+l_ar );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    std::cout << "running kernel" << std::endl;
+    l_err = clEnqueueNDRangeKernel( l_queue,
+                                    l_launch.kernel,
+                                    l_launch.work_dim,
+                                    NULL,
+                                    l_launch.global_size,
+                                    l_launch.use_local_size ? l_launch.local_size : NULL,
+                                    0,
+                                    NULL,
+                                    NULL );
+    assert( l_err == CL_SUCCESS );
+
+    l_err = clFinish( l_queue );
+    assert( l_err == CL_SUCCESS );
+    std::chrono::steady_clock::time_point l_tp_verify = std::chrono::steady_clock::now();
+
+    // verify C on the device, the result is written in any case
+    bool l_verified = true;
+    if( i_abft ){
+        std::size_t l_fault_row = 0;
+        std::size_t l_fault_col = 0;
+        if( i_inject ){
+            abft_inject< T >( l_queue,
+                              l_c_device,
+                              l_abft,
+                              l_fault_row,
+                              l_fault_col );
+        }
+
+        abft_report l_report;
+        l_verified = abft_verify( l_queue,
+                                  l_c_device,
+                                  l_abft,
+                                  l_report );
+        print_abft_report( l_report );
+        abft_release( l_abft );
+
+        if( i_inject ){
+            l_verified = abft_located( l_report, l_fault_row, l_fault_col );
+            std::cout << "abft: fault injected at row " << l_fault_row << ", column " << l_fault_col
+                      << ( l_verified ? " was located" : " was not located" ) << std::endl;
+        }
+    }
+    std::chrono::steady_clock::time_point l_tp2 = std::chrono::steady_clock::now();
+
+    // stream the result back
+    std::cout << "streaming result from device to file" << std::endl;
+    npy_file l_c;
+    std::vector< std::size_t > l_c_shape = { l_m, l_n };
+    l_ok = npy_create( i_c_path,
+                       elem::npy_descr(),
+                       false,
+                       l_c_shape,
+                       l_c );
+    if( l_ok ){
+        l_ok = npy_from_buffer( l_queue, l_c_device, l_c, -1 );
+        npy_close( l_c );
+    }
+    std::chrono::steady_clock::time_point l_tp3 = std::chrono::steady_clock::now();
+
+    double l_time_load  = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp1 - l_tp0 ).count();
+    double l_time_gemm  = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp_verify - l_tp_gemm ).count();
+    double l_time_abft  = std::chrono::duration_cast< std::chrono::duration< double > >( (l_tp_gemm - l_tp1) + (l_tp2 - l_tp_verify) ).count();
+    double l_time_store = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp3 - l_tp2 ).count();
+    double l_bytes_load = sizeof(T) * ( l_m*l_k + l_k*l_n + (i_c_in_path != NULL ? l_m*l_n : 0) );
+
+    std::cout << "load:  " << l_time_load  << " s, " << 1.0E-9 * l_bytes_load / l_time_load << " GB/s" << std::endl;
+    std::cout << "gemm:  " << l_time_gemm  << " s, " << 2.0E-9 * l_m*l_n*l_k / l_time_gemm << " GFLOPS" << std::endl;
+    if( i_abft ){
+        std::cout << "abft:  " << l_time_abft  << " s for " << 100.0 * abft_flop_ratio( l_m, l_n ) << " % extra flops" << std::endl;
+    }
+    std::cout << "store: " << l_time_store << " s, " << 1.0E-9 * sizeof(T)*l_m*l_n / l_time_store << " GB/s" << std::endl;
+
+    clReleaseMemObject( l_a_device );
+    clReleaseMemObject( l_b_device );
+    clReleaseMemObject( l_c_device );
+    clReleaseCommandQueue( l_queue );
+
+    return l_ok && l_verified ? 0 : 1;
+}
+
+int main( int i_argc, char * i_argv[] ){
+    std::cout << "starting device query" << std::endl;
+
+    cl_int l_err = CL_SUCCESS;
+
+    // number of platforms
+    cl_uint l_n_platforms = 0;
+    l_err = clGetPlatformIDs( 0, 
+                              NULL, 
+                              &l_n_platforms );
+    assert( l_err == CL_SUCCESS );
+    std::cout << "number of platforms: " << l_n_platforms << std::endl;
+    assert( l_n_platforms > 0);
+
+    // platform IDs
+    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
+    l_err = clGetPlatformIDs( l_n_platforms, 
+                              l_platform_ids, 
+                              NULL);
+    assert( l_err == CL_SUCCESS );
+
+    cl_char l_tmp_string[8192] = {0};
+
+    // platform name
+    l_err = clGetPlatformInfo(  l_platform_ids[0], 
+                                CL_PLATFORM_NAME, 
+                                sizeof(l_tmp_string), 
+                                &l_tmp_string, 
+                                NULL );   
+
+    assert( l_err == CL_SUCCESS);
+
+    std::cout << "  CL_PLATFORM_NAME: " << l_tmp_string << std::endl;
+
+    // number of devices
+    cl_uint l_n_devices = 0;
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            0, 
+                            NULL, 
+                            &l_n_devices );
+    assert( l_err == CL_SUCCESS );
+
+    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            l_n_devices,
+                            l_device_ids, 
+                            NULL );
+    assert( l_err == CL_SUCCESS );
+
+    l_err = clGetDeviceInfo(    l_device_ids[0],
+                                CL_DEVICE_OPENCL_C_VERSION,
+                                sizeof(l_tmp_string),
+                                &l_tmp_string, 
+                                NULL );
+    assert( l_err == CL_SUCCESS );
+
+    std::cout << "  CL_DEVICE_OPENCL_C_VERSION: " << l_tmp_string << std::endl;
+
+    /*
+     * prepare program execution
+     */
+    cl_context l_context = clCreateContext( NULL,
+                                            1,
+                                            l_device_ids+0,
+                                            NULL,
+                                            NULL,
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    // autotuning mode: gemm_opencl_n4_n8 tune [m n k]
+    if( i_argc > 1 && std::string( i_argv[1] ) == "tune" ){
+        if( i_argc != 2 && i_argc != 5 ){
+            std::cerr << "usage: gemm_opencl_n4_n8 tune [m n k]" << std::endl;
+            return 1;
+        }
+        std::size_t l_tune_m = 512;
+        std::size_t l_tune_n = 512;
+        std::size_t l_tune_k = 512;
+        if( i_argc == 5 ){
+            l_tune_m = std::strtoul( i_argv[2], NULL, 10 );
+            l_tune_n = std::strtoul( i_argv[3], NULL, 10 );
+            l_tune_k = std::strtoul( i_argv[4], NULL, 10 );
+        }
+        if( l_tune_m == 0 || l_tune_n == 0 || l_tune_k == 0 ){
+            std::cerr << "usage: gemm_opencl_n4_n8 tune [m n k] with positive m, n, k" << std::endl;
+            return 1;
+        }
+        return tune_gemm( l_context,
+                          l_device_ids[0],
+                          l_tune_m,
+                          l_tune_n,
+                          l_tune_k );
+    }
+
+    // checksum verification: gemm_opencl_n4_n8 abft [inject] [arguments below]
+    bool l_abft = i_argc > 1 && std::string( i_argv[1] ) == "abft";
+    if( l_abft ){
+        i_argc--;
+        i_argv++;
+    }
+    bool l_inject = l_abft && i_argc > 1 && std::string( i_argv[1] ) == "inject";
+    if( l_inject ){
+        i_argc--;
+        i_argv++;
+    }
+
+    // element type: gemm_opencl_n4_n8 [float|double|half]
+    std::string l_type = "float";
+    if( i_argc > 1 ){
+        l_type = i_argv[1];
+    }
+    if( l_type != "float" && l_type != "double" && l_type != "half" ){
+        std::cerr << "unknown element type " << l_type << ", usage: gemm_opencl_n4_n8 [abft [inject]] [float|double|half] [a.npy b.npy c.npy [c_in.npy]]" << std::endl;
+        return 1;
+    }
+
+    // matrix files: gemm_opencl_n4_n8 <type> <a.npy> <b.npy> <c_out.npy> [c_in.npy]
+    bool l_files = i_argc > 4;
+    const char * l_c_in = i_argc > 5 ? i_argv[5] : NULL;
+
+    int l_ret = 0;
+    if( l_files && (l_type == "double" || l_type == "half") && !device_supports( l_device_ids[0], l_type == "double" ? "cl_khr_fp64" : "cl_khr_fp16" ) ){
+        // the files' dtype has to match, no fallback
+        std::cerr << "element type " << l_type << " is not supported by the device" << std::endl;
+        l_ret = 1;
+    }
+    else if( l_files && l_type == "double" ){
+        l_ret = run_gemm_files< cl_double >( l_context, l_device_ids[0], i_argv[2], i_argv[3], i_argv[4], l_c_in, l_abft, l_inject );
+    }
+    else if( l_files && l_type == "half" ){
+        l_ret = run_gemm_files< cl_half >( l_context, l_device_ids[0], i_argv[2], i_argv[3], i_argv[4], l_c_in, l_abft, l_inject );
+    }
+    else if( l_files ){
+        l_ret = run_gemm_files< cl_float >( l_context, l_device_ids[0], i_argv[2], i_argv[3], i_argv[4], l_c_in, l_abft, l_inject );
+    }
+    else if( l_type == "double" && device_supports( l_device_ids[0], element_type< cl_double >::extension() ) ){
+        l_ret = run_gemm< cl_double >( l_context, l_device_ids[0], l_abft, l_inject );
+    }
+    else if( l_type == "half" && device_supports( l_device_ids[0], element_type< cl_half >::extension() ) ){
+        l_ret = run_gemm< cl_half >( l_context, l_device_ids[0], l_abft, l_inject );
+    }
+    else{
+        if( l_type != "float" ){
+            std::cout << "element type " << l_type << " is not supported by the device, falling back to float" << std::endl;
+        }
+        l_ret = run_gemm< cl_float >( l_context, l_device_ids[0], l_abft, l_inject );
+    }
+
     delete [] l_device_ids;
     delete [] l_platform_ids;
 
     std::cout << "device query ended" << std::endl;
-}
\ No newline at end of file
+
+    return l_ret;
+}
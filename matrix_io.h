@@ -0,0 +1,445 @@
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "packing.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+ * Binary matrix files in the .npy format (version 1.0 to 3.0, little endian
+ * '<f2', '<f4' or '<f8', C or Fortran order). Files are memory mapped and
+ * copied chunk by chunk into mapped device buffers, so loading an operand
+ * reads every byte once and never goes through an intermediate host array.
+ */
+
+// bytes copied per map/unmap of the device buffer, multiple of 4 elements of every type
+static const std::size_t l_npy_chunk_size = std::size_t(64) << 20;
+
+/**
+ * Memory mapped .npy file.
+ **/
+struct npy_file {
+    int                        fd;
+    char                     * map;
+    std::size_t                map_size;
+    char                     * data;
+    std::size_t                data_size;
+    std::string                descr;
+    bool                       fortran_order;
+    std::vector< std::size_t > shape;
+};
+
+/**
+ * Returns the value of a key in the header dictionary of a .npy file.
+ *
+ * @param i_header header dictionary, e.g. "{'descr': '<f4', 'fortran_order': False, 'shape': (4, 8), }".
+ * @param i_key key without quotes.
+ * @return value as written in the header, empty if the key does not exist.
+ **/
+inline std::string npy_header_value( std::string const & i_header,
+                                     std::string const & i_key ){
+    std::size_t l_pos = i_header.find( "'" + i_key + "'" );
+    if( l_pos == std::string::npos ){
+        return "";
+    }
+    l_pos = i_header.find( ':', l_pos );
+    if( l_pos == std::string::npos ){
+        return "";
+    }
+    l_pos = i_header.find_first_not_of( ' ', l_pos+1 );
+    if( l_pos == std::string::npos ){
+        return "";
+    }
+
+    std::size_t l_end = std::string::npos;
+    if( i_header[l_pos] == '(' ){
+        l_end = i_header.find( ')', l_pos ) + 1;
+    }
+    else if( i_header[l_pos] == '\'' ){
+        l_end = i_header.find( '\'', l_pos+1 ) + 1;
+    }
+    else{
+        l_end = i_header.find_first_of( ",}", l_pos );
+    }
+    if( l_end == std::string::npos || l_end == 0 ){
+        return "";
+    }
+    return i_header.substr( l_pos, l_end-l_pos );
+}
+
+/**
+ * Returns the size in bytes of an element of a .npy dtype.
+ *
+ * @param i_descr dtype, e.g. "<f4".
+ * @return size in bytes, 0 if the dtype is not supported.
+ **/
+inline std::size_t npy_elem_size( std::string const & i_descr ){
+    if( i_descr == "<f2" ) return 2;
+    if( i_descr == "<f4" ) return 4;
+    if( i_descr == "<f8" ) return 8;
+    return 0;
+}
+
+/**
+ * Opens and memory maps a .npy file for reading.
+ *
+ * @param i_path path of the file.
+ * @param o_file will be set to the mapped file.
+ * @return true on success, false otherwise.
+ **/
+inline bool npy_open( const char * i_path,
+                      npy_file   & o_file ){
+    o_file.fd = open( i_path, O_RDONLY );
+    if( o_file.fd < 0 ){
+        std::cerr << "failed to open " << i_path << std::endl;
+        return false;
+    }
+
+    struct stat l_stat;
+    if( fstat( o_file.fd, &l_stat ) != 0 || l_stat.st_size < 10 ){
+        std::cerr << "failed to stat " << i_path << std::endl;
+        close( o_file.fd );
+        return false;
+    }
+    o_file.map_size = l_stat.st_size;
+
+    void * l_map = mmap( NULL,
+                         o_file.map_size,
+                         PROT_READ,
+                         MAP_PRIVATE,
+                         o_file.fd,
+                         0 );
+    if( l_map == MAP_FAILED ){
+        std::cerr << "failed to map " << i_path << std::endl;
+        close( o_file.fd );
+        return false;
+    }
+    o_file.map = static_cast< char * >( l_map );
+    madvise( o_file.map, o_file.map_size, MADV_SEQUENTIAL );
+
+    // magic string, version and header length
+    unsigned char * l_bytes = reinterpret_cast< unsigned char * >( o_file.map );
+    std::size_t l_header_start = 0;
+    std::size_t l_header_size = 0;
+    if( std::memcmp( o_file.map, "\x93NUMPY", 6 ) != 0 ){
+        std::cerr << i_path << " is not a .npy file" << std::endl;
+        munmap( o_file.map, o_file.map_size );
+        close( o_file.fd );
+        return false;
+    }
+    if( l_bytes[6] < 1 || l_bytes[6] > 3 || (l_bytes[6] > 1 && o_file.map_size < 12) ){
+        std::cerr << "unsupported version or truncated preamble in " << i_path << std::endl;
+        munmap( o_file.map, o_file.map_size );
+        close( o_file.fd );
+        return false;
+    }
+    if( l_bytes[6] == 1 ){
+        l_header_start = 10;
+        l_header_size = l_bytes[8] | (l_bytes[9] << 8);
+    }
+    else{
+        l_header_start = 12;
+        l_header_size =   static_cast< std::size_t >( l_bytes[8] )
+                        | static_cast< std::size_t >( l_bytes[9] ) << 8
+                        | static_cast< std::size_t >( l_bytes[10] ) << 16
+                        | static_cast< std::size_t >( l_bytes[11] ) << 24;
+    }
+    if( l_header_start + l_header_size > o_file.map_size ){
+        std::cerr << "truncated header in " << i_path << std::endl;
+        munmap( o_file.map, o_file.map_size );
+        close( o_file.fd );
+        return false;
+    }
+
+    std::string l_header( o_file.map + l_header_start, l_header_size );
+    o_file.descr = npy_header_value( l_header, "descr" );
+    if( o_file.descr.size() > 2 ){
+        o_file.descr = o_file.descr.substr( 1, o_file.descr.size()-2 );
+    }
+    o_file.fortran_order = npy_header_value( l_header, "fortran_order" ) == "True";
+
+    std::string l_shape = npy_header_value( l_header, "shape" );
+    o_file.shape.clear();
+    std::size_t l_dim = 0;
+    bool l_in_dim = false;
+    for( std::size_t l_ch = 0; l_ch < l_shape.size(); l_ch++ ){
+        if( l_shape[l_ch] >= '0' && l_shape[l_ch] <= '9' ){
+            l_dim = l_dim*10 + (l_shape[l_ch] - '0');
+            l_in_dim = true;
+        }
+        else if( l_in_dim ){
+            o_file.shape.push_back( l_dim );
+            l_dim = 0;
+            l_in_dim = false;
+        }
+    }
+
+    std::size_t l_elem_size = npy_elem_size( o_file.descr );
+    std::size_t l_n_elems = 1;
+    bool l_overflow = false;
+    for( std::size_t l_di = 0; l_di < o_file.shape.size(); l_di++ ){
+        // a wrapped product would pass the size check below
+        if( o_file.shape[l_di] != 0 && l_n_elems > o_file.map_size / o_file.shape[l_di] ){
+            l_overflow = true;
+        }
+        l_n_elems *= o_file.shape[l_di];
+    }
+    o_file.data = o_file.map + l_header_start + l_header_size;
+    o_file.data_size = l_n_elems * l_elem_size;
+
+    if( l_elem_size == 0 ){
+        std::cerr << "unsupported dtype " << o_file.descr << " in " << i_path << std::endl;
+        munmap( o_file.map, o_file.map_size );
+        close( o_file.fd );
+        return false;
+    }
+    if( l_overflow || o_file.data_size > o_file.map_size - (l_header_start + l_header_size) ){
+        std::cerr << "truncated data in " << i_path << std::endl;
+        munmap( o_file.map, o_file.map_size );
+        close( o_file.fd );
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Creates a .npy file of the given dtype and shape and memory maps it for writing.
+ *
+ * @param i_path path of the file.
+ * @param i_descr dtype, e.g. "<f4".
+ * @param i_fortran_order true for column-major, false for row-major data.
+ * @param i_shape shape of the matrix.
+ * @param o_file will be set to the mapped file.
+ * @return true on success, false otherwise.
+ **/
+inline bool npy_create( const char                       * i_path,
+                        std::string const                & i_descr,
+                        bool                               i_fortran_order,
+                        std::vector< std::size_t > const & i_shape,
+                        npy_file                         & o_file ){
+    o_file.descr = i_descr;
+    o_file.fortran_order = i_fortran_order;
+    o_file.shape = i_shape;
+
+    std::string l_header = "{'descr': '" + i_descr + "', 'fortran_order': ";
+    l_header += i_fortran_order ? "True" : "False";
+    l_header += ", 'shape': (";
+    std::size_t l_n_elems = 1;
+    for( std::size_t l_di = 0; l_di < i_shape.size(); l_di++ ){
+        l_header += ( l_di > 0 ? ", " : "" ) + std::to_string( i_shape[l_di] );
+        l_n_elems *= i_shape[l_di];
+    }
+    l_header += i_shape.size() == 1 ? ",), }" : "), }";
+    // header ends with a newline and the data starts 64 byte aligned
+    while( (10 + l_header.size() + 1) % 64 != 0 ){
+        l_header += ' ';
+    }
+    l_header += '\n';
+
+    o_file.data_size = l_n_elems * npy_elem_size( i_descr );
+    o_file.map_size = 10 + l_header.size() + o_file.data_size;
+
+    o_file.fd = open( i_path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( o_file.fd < 0 ){
+        std::cerr << "failed to create " << i_path << std::endl;
+        return false;
+    }
+    if( ftruncate( o_file.fd, o_file.map_size ) != 0 ){
+        std::cerr << "failed to resize " << i_path << std::endl;
+        close( o_file.fd );
+        return false;
+    }
+
+    void * l_map = mmap( NULL,
+                         o_file.map_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED,
+                         o_file.fd,
+                         0 );
+    if( l_map == MAP_FAILED ){
+        std::cerr << "failed to map " << i_path << std::endl;
+        close( o_file.fd );
+        return false;
+    }
+    o_file.map = static_cast< char * >( l_map );
+
+    std::memcpy( o_file.map, "\x93NUMPY\x01\x00", 8 );
+    o_file.map[8] = static_cast< char >( l_header.size() & 0xff );
+    o_file.map[9] = static_cast< char >( l_header.size() >> 8 );
+    std::memcpy( o_file.map+10, l_header.data(), l_header.size() );
+    o_file.data = o_file.map + 10 + l_header.size();
+
+    return true;
+}
+
+/**
+ * Unmaps and closes a .npy file, written data is flushed to disk.
+ *
+ * @param io_file mapped file.
+ **/
+inline void npy_close( npy_file & io_file ){
+    munmap( io_file.map, io_file.map_size );
+    close( io_file.fd );
+    io_file.map = NULL;
+    io_file.data = NULL;
+}
+
+/**
+ * Copies elements and optionally converts between the standard order of four consecutive
+ * columns (0, 1, 2, 3) and the order of the gemm kernels' C matrix (1, 2, 3, 0), in which
+ * .w holds the first column of each vector.
+ *
+ * @param i_src source.
+ * @param o_dst destination.
+ * @param i_size number of bytes, multiple of 4 elements if i_shuffle is not 0.
+ * @param i_elem_size size of an element in bytes.
+ * @param i_shuffle 0: plain copy, 1: standard to kernel order, -1: kernel to standard order.
+ **/
+inline void npy_copy( const char  * i_src,
+                      char        * o_dst,
+                      std::size_t   i_size,
+                      std::size_t   i_elem_size,
+                      int           i_shuffle ){
+    if( i_shuffle == 0 ){
+        std::memcpy( o_dst, i_src, i_size );
+        return;
+    }
+
+    // the rotation only moves elements, so an unsigned integer of the same size stands in for the type
+    std::size_t l_n_elems = i_size / i_elem_size;
+    if( i_elem_size == 2 ){
+        rotate_c( reinterpret_cast< const uint16_t * >( i_src ), reinterpret_cast< uint16_t * >( o_dst ), l_n_elems, i_shuffle > 0 );
+    }
+    else if( i_elem_size == 4 ){
+        rotate_c( reinterpret_cast< const uint32_t * >( i_src ), reinterpret_cast< uint32_t * >( o_dst ), l_n_elems, i_shuffle > 0 );
+    }
+    else{
+        assert( i_elem_size == 8 );
+        rotate_c( reinterpret_cast< const uint64_t * >( i_src ), reinterpret_cast< uint64_t * >( o_dst ), l_n_elems, i_shuffle > 0 );
+    }
+}
+
+/**
+ * Streams the data of a mapped .npy file into a device buffer, chunk by chunk.
+ * The buffer should be created with CL_MEM_ALLOC_HOST_PTR so that mapping it is free.
+ *
+ * @param i_queue command queue.
+ * @param i_file mapped file.
+ * @param o_buffer device buffer of at least i_file.data_size bytes.
+ * @param i_shuffle see npy_copy.
+ * @return true on success, false otherwise.
+ **/
+inline bool npy_to_buffer( cl_command_queue   i_queue,
+                           npy_file const   & i_file,
+                           cl_mem             o_buffer,
+                           int                i_shuffle ){
+    std::size_t l_elem_size = npy_elem_size( i_file.descr );
+
+    for( std::size_t l_off = 0; l_off < i_file.data_size; l_off += l_npy_chunk_size ){
+        std::size_t l_size = std::min( l_npy_chunk_size, i_file.data_size - l_off );
+
+        cl_int l_err = CL_SUCCESS;
+        void * l_ptr = clEnqueueMapBuffer(  i_queue,
+                                            o_buffer,
+                                            CL_TRUE,
+                                            CL_MAP_WRITE_INVALIDATE_REGION,
+                                            l_off,
+                                            l_size,
+                                            0,
+                                            NULL,
+                                            NULL,
+                                            &l_err );
+        if( l_err != CL_SUCCESS ){
+            std::cerr << "failed to map device buffer" << std::endl;
+            return false;
+        }
+
+        npy_copy( i_file.data+l_off,
+                  static_cast< char * >( l_ptr ),
+                  l_size,
+                  l_elem_size,
+                  i_shuffle );
+
+        l_err = clEnqueueUnmapMemObject(    i_queue,
+                                            o_buffer,
+                                            l_ptr,
+                                            0,
+                                            NULL,
+                                            NULL );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    return true;
+}
+
+/**
+ * Streams a device buffer into the data of a mapped .npy file, chunk by chunk.
+ *
+ * @param i_queue command queue.
+ * @param i_buffer device buffer of at least io_file.data_size bytes.
+ * @param io_file mapped file, created with npy_create.
+ * @param i_shuffle see npy_copy.
+ * @return true on success, false otherwise.
+ **/
+inline bool npy_from_buffer( cl_command_queue   i_queue,
+                             cl_mem             i_buffer,
+                             npy_file         & io_file,
+                             int                i_shuffle ){
+    std::size_t l_elem_size = npy_elem_size( io_file.descr );
+
+    for( std::size_t l_off = 0; l_off < io_file.data_size; l_off += l_npy_chunk_size ){
+        std::size_t l_size = std::min( l_npy_chunk_size, io_file.data_size - l_off );
+
+        cl_int l_err = CL_SUCCESS;
+        void * l_ptr = clEnqueueMapBuffer(  i_queue,
+                                            i_buffer,
+                                            CL_TRUE,
+                                            CL_MAP_READ,
+                                            l_off,
+                                            l_size,
+                                            0,
+                                            NULL,
+                                            NULL,
+                                            &l_err );
+        if( l_err != CL_SUCCESS ){
+            std::cerr << "failed to map device buffer" << std::endl;
+            return false;
+        }
+
+        npy_copy( static_cast< char * >( l_ptr ),
+                  io_file.data+l_off,
+                  l_size,
+                  l_elem_size,
+                  i_shuffle );
+
+        l_err = clEnqueueUnmapMemObject(    i_queue,
+                                            i_buffer,
+                                            l_ptr,
+                                            0,
+                                            NULL,
+                                            NULL );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    return true;
+}
+
+#endif
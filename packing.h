@@ -0,0 +1,394 @@
+#ifndef PACKING_H
+#define PACKING_H
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * Host side packing of standard row- or column-major matrices into the layout
+ * of the gemm kernels: A row-major (m, k), B column-major (k, n) and C row-major
+ * (m, n) with each group of four columns stored as (1, 2, 3, 0), so that .w holds
+ * the first column. Work is split by rows of the destination over a pool of pinned
+ * threads; every thread writes its rows first, so on NUMA systems the pages of the
+ * packed matrix are placed next to the thread that packed them (first touch).
+ * The destination must therefore not be touched before packing.
+ */
+
+// edge of the square blocks in which matrices are transposed
+static const std::size_t l_pack_block = 64;
+
+/**
+ * Pool of worker threads, pinned to one CPU each.
+ * Only CPUs in the process' affinity mask are used (taskset, cpusets), pins that fail are reported.
+ **/
+class thread_pool {
+    public:
+        /**
+         * Starts the worker threads.
+         *
+         * @param i_n_threads number of threads, 0 for one per CPU.
+         **/
+        explicit thread_pool( std::size_t i_n_threads = 0 ){
+            // CPUs the process may run on
+            std::vector< int > l_cpus;
+#ifdef __linux__
+            cpu_set_t l_allowed;
+            CPU_ZERO( &l_allowed );
+            if( sched_getaffinity( 0, sizeof(l_allowed), &l_allowed ) == 0 ){
+                for( int l_cpu = 0; l_cpu < CPU_SETSIZE; l_cpu++ ){
+                    if( CPU_ISSET( l_cpu, &l_allowed ) ){
+                        l_cpus.push_back( l_cpu );
+                    }
+                }
+            }
+            else{
+                std::cerr << "thread_pool: sched_getaffinity failed, threads are not pinned" << std::endl;
+            }
+#endif
+            if( i_n_threads == 0 ){
+                i_n_threads = l_cpus.empty() ? std::max( 1u, std::thread::hardware_concurrency() ) : l_cpus.size();
+            }
+            for( std::size_t l_th = 0; l_th < i_n_threads; l_th++ ){
+                m_threads.push_back( std::thread( &thread_pool::work, this, l_th ) );
+#ifdef __linux__
+                if( l_cpus.empty() ){
+                    continue;
+                }
+                int l_cpu = l_cpus[ l_th % l_cpus.size() ];
+                cpu_set_t l_set;
+                CPU_ZERO( &l_set );
+                CPU_SET( l_cpu, &l_set );
+                int l_ret = pthread_setaffinity_np( m_threads.back().native_handle(), sizeof(l_set), &l_set );
+                if( l_ret != 0 ){
+                    std::cerr << "thread_pool: failed to pin thread " << l_th << " to CPU " << l_cpu
+                              << " (" << std::strerror( l_ret ) << "), first touch placement is not guaranteed" << std::endl;
+                }
+#endif
+            }
+        }
+
+        /**
+         * Stops the worker threads.
+         **/
+        ~thread_pool(){
+            {
+                std::unique_lock< std::mutex > l_lock( m_mutex );
+                m_stop = true;
+            }
+            m_cv_start.notify_all();
+            for( std::size_t l_th = 0; l_th < m_threads.size(); l_th++ ){
+                m_threads[l_th].join();
+            }
+        }
+
+        /**
+         * @return number of worker threads.
+         **/
+        std::size_t size() const {
+            return m_threads.size();
+        }
+
+        /**
+         * Calls the function once on every worker thread and waits for all calls to return.
+         *
+         * @param i_func function, called with the id of the thread.
+         **/
+        void run( std::function< void( std::size_t ) > const & i_func ){
+            std::unique_lock< std::mutex > l_lock( m_mutex );
+            m_func = &i_func;
+            m_n_done = 0;
+            m_generation++;
+            m_cv_start.notify_all();
+            m_cv_done.wait( l_lock, [this]{ return m_n_done == m_threads.size(); } );
+            m_func = NULL;
+        }
+
+    private:
+        void work( std::size_t i_id ){
+            std::size_t l_generation = 0;
+            while( true ){
+                std::function< void( std::size_t ) > const * l_func = NULL;
+                {
+                    std::unique_lock< std::mutex > l_lock( m_mutex );
+                    m_cv_start.wait( l_lock, [&]{ return m_stop || m_generation != l_generation; } );
+                    if( m_stop ){
+                        return;
+                    }
+                    l_generation = m_generation;
+                    l_func = m_func;
+                }
+
+                (*l_func)( i_id );
+
+                std::unique_lock< std::mutex > l_lock( m_mutex );
+                m_n_done++;
+                if( m_n_done == m_threads.size() ){
+                    m_cv_done.notify_one();
+                }
+            }
+        }
+
+        std::vector< std::thread >                   m_threads;
+        std::mutex                                   m_mutex;
+        std::condition_variable                      m_cv_start;
+        std::condition_variable                      m_cv_done;
+        std::function< void( std::size_t ) > const * m_func = NULL;
+        std::size_t                                  m_generation = 0;
+        std::size_t                                  m_n_done = 0;
+        bool                                         m_stop = false;
+};
+
+/**
+ * Transposes a 4x4 block of 4 byte elements.
+ *
+ * @param i_src first element of the source block.
+ * @param i_ld_src leading dimension of the source.
+ * @param o_dst first element of the destination block.
+ * @param i_ld_dst leading dimension of the destination.
+ **/
+inline void transpose_4x4( const float * i_src,
+                           std::size_t   i_ld_src,
+                           float       * o_dst,
+                           std::size_t   i_ld_dst ){
+#if defined(__ARM_NEON)
+    float32x4_t l_r0 = vld1q_f32( i_src );
+    float32x4_t l_r1 = vld1q_f32( i_src +   i_ld_src );
+    float32x4_t l_r2 = vld1q_f32( i_src + 2*i_ld_src );
+    float32x4_t l_r3 = vld1q_f32( i_src + 3*i_ld_src );
+    float32x4x2_t l_t01 = vtrnq_f32( l_r0, l_r1 );
+    float32x4x2_t l_t23 = vtrnq_f32( l_r2, l_r3 );
+    vst1q_f32( o_dst,              vcombine_f32( vget_low_f32(  l_t01.val[0] ), vget_low_f32(  l_t23.val[0] ) ) );
+    vst1q_f32( o_dst +   i_ld_dst, vcombine_f32( vget_low_f32(  l_t01.val[1] ), vget_low_f32(  l_t23.val[1] ) ) );
+    vst1q_f32( o_dst + 2*i_ld_dst, vcombine_f32( vget_high_f32( l_t01.val[0] ), vget_high_f32( l_t23.val[0] ) ) );
+    vst1q_f32( o_dst + 3*i_ld_dst, vcombine_f32( vget_high_f32( l_t01.val[1] ), vget_high_f32( l_t23.val[1] ) ) );
+#elif defined(__SSE__)
+    __m128 l_r0 = _mm_loadu_ps( i_src );
+    __m128 l_r1 = _mm_loadu_ps( i_src +   i_ld_src );
+    __m128 l_r2 = _mm_loadu_ps( i_src + 2*i_ld_src );
+    __m128 l_r3 = _mm_loadu_ps( i_src + 3*i_ld_src );
+    _MM_TRANSPOSE4_PS( l_r0, l_r1, l_r2, l_r3 );
+    _mm_storeu_ps( o_dst,              l_r0 );
+    _mm_storeu_ps( o_dst +   i_ld_dst, l_r1 );
+    _mm_storeu_ps( o_dst + 2*i_ld_dst, l_r2 );
+    _mm_storeu_ps( o_dst + 3*i_ld_dst, l_r3 );
+#else
+    for( std::size_t l_ro = 0; l_ro < 4; l_ro++ ){
+        for( std::size_t l_co = 0; l_co < 4; l_co++ ){
+            o_dst[l_co*i_ld_dst + l_ro] = i_src[l_ro*i_ld_src + l_co];
+        }
+    }
+#endif
+}
+
+/**
+ * Transposes a block: o_dst[c*i_ld_dst + r] = i_src[r*i_ld_src + c].
+ * 4 byte elements use SIMD 4x4 transposes for the full 4x4 tiles.
+ *
+ * @param i_src first element of the source block.
+ * @param i_ld_src leading dimension of the source.
+ * @param o_dst first element of the destination block.
+ * @param i_ld_dst leading dimension of the destination.
+ * @param i_rows rows of the source block.
+ * @param i_cols columns of the source block.
+ **/
+template< typename T >
+void transpose_block( const T     * i_src,
+                      std::size_t   i_ld_src,
+                      T           * o_dst,
+                      std::size_t   i_ld_dst,
+                      std::size_t   i_rows,
+                      std::size_t   i_cols ){
+    std::size_t l_ro = 0;
+    std::size_t l_co = 0;
+    if( sizeof(T) == sizeof(float) ){
+        for( l_co = 0; l_co+4 <= i_cols; l_co += 4 ){
+            for( l_ro = 0; l_ro+4 <= i_rows; l_ro += 4 ){
+                transpose_4x4( reinterpret_cast< const float * >( i_src + l_ro*i_ld_src + l_co ),
+                               i_ld_src,
+                               reinterpret_cast< float * >( o_dst + l_co*i_ld_dst + l_ro ),
+                               i_ld_dst );
+            }
+        }
+        // remainder rows of the 4-wide columns
+        for( std::size_t l_c = 0; l_c < l_co; l_c++ ){
+            for( std::size_t l_r = l_ro; l_r < i_rows; l_r++ ){
+                o_dst[l_c*i_ld_dst + l_r] = i_src[l_r*i_ld_src + l_c];
+            }
+        }
+    }
+    for( std::size_t l_c = l_co; l_c < i_cols; l_c++ ){
+        for( std::size_t l_r = 0; l_r < i_rows; l_r++ ){
+            o_dst[l_c*i_ld_dst + l_r] = i_src[l_r*i_ld_src + l_c];
+        }
+    }
+}
+
+/**
+ * Packs a matrix into a row-major destination, in parallel over the destination's rows.
+ *
+ * @param io_pool thread pool.
+ * @param i_src source matrix.
+ * @param i_transposed false: source is row-major (i_rows, i_cols), true: source is column-major (i_rows, i_cols).
+ * @param i_rows rows of the destination.
+ * @param i_cols columns of the destination.
+ * @param o_dst row-major destination (i_rows, i_cols), untouched before.
+ **/
+template< typename T >
+void pack_matrix( thread_pool & io_pool,
+                  const T     * i_src,
+                  bool          i_transposed,
+                  std::size_t   i_rows,
+                  std::size_t   i_cols,
+                  T           * o_dst ){
+    // rows per thread, multiple of the block size
+    std::size_t l_n_blocks = (i_rows + l_pack_block - 1) / l_pack_block;
+    std::size_t l_blocks_per_thread = (l_n_blocks + io_pool.size() - 1) / io_pool.size();
+
+    io_pool.run( [&]( std::size_t i_id ){
+        std::size_t l_first = std::min( i_rows, i_id * l_blocks_per_thread * l_pack_block );
+        std::size_t l_last  = std::min( i_rows, l_first + l_blocks_per_thread * l_pack_block );
+
+        if( !i_transposed ){
+            std::memcpy( o_dst + l_first*i_cols,
+                         i_src + l_first*i_cols,
+                         sizeof(T) * (l_last-l_first) * i_cols );
+            return;
+        }
+
+        // the source's columns are the destination's rows
+        for( std::size_t l_rb = l_first; l_rb < l_last; l_rb += l_pack_block ){
+            for( std::size_t l_cb = 0; l_cb < i_cols; l_cb += l_pack_block ){
+                transpose_block( i_src + l_cb*i_rows + l_rb,
+                                 i_rows,
+                                 o_dst + l_rb*i_cols + l_cb,
+                                 i_cols,
+                                 std::min( l_pack_block, i_cols-l_cb ),
+                                 std::min( l_pack_block, l_last-l_rb ) );
+            }
+        }
+    } );
+}
+
+/**
+ * Packs A (m, k) into the gemm layout: row-major.
+ *
+ * @param io_pool thread pool.
+ * @param i_a A, row-major or column-major.
+ * @param i_col_major true if i_a is column-major.
+ * @param i_m rows of A.
+ * @param i_k columns of A.
+ * @param o_a packed A.
+ **/
+template< typename T >
+void pack_a( thread_pool & io_pool,
+             const T     * i_a,
+             bool          i_col_major,
+             std::size_t   i_m,
+             std::size_t   i_k,
+             T           * o_a ){
+    pack_matrix( io_pool, i_a, i_col_major, i_m, i_k, o_a );
+}
+
+/**
+ * Packs B (k, n) into the gemm layout: column-major, i.e. row-major (n, k).
+ *
+ * @param io_pool thread pool.
+ * @param i_b B, row-major or column-major.
+ * @param i_col_major true if i_b is column-major.
+ * @param i_k rows of B.
+ * @param i_n columns of B.
+ * @param o_b packed B.
+ **/
+template< typename T >
+void pack_b( thread_pool & io_pool,
+             const T     * i_b,
+             bool          i_col_major,
+             std::size_t   i_k,
+             std::size_t   i_n,
+             T           * o_b ){
+    pack_matrix( io_pool, i_b, !i_col_major, i_n, i_k, o_b );
+}
+
+/**
+ * Converts groups of four consecutive columns between the standard order (0, 1, 2, 3)
+ * and the order of the gemm kernels' C (1, 2, 3, 0), in which .w holds the first column.
+ *
+ * @param i_src source.
+ * @param o_dst destination, must not overlap the source.
+ * @param i_size number of elements, multiple of 4.
+ * @param i_to_kernel true: standard to kernel order, false: kernel to standard order.
+ **/
+template< typename T >
+void rotate_c( const T     * i_src,
+               T           * o_dst,
+               std::size_t   i_size,
+               bool          i_to_kernel ){
+    for( std::size_t l_en = 0; l_en < i_size; l_en += 4 ){
+        if( i_to_kernel ){
+            o_dst[l_en+0] = i_src[l_en+1];
+            o_dst[l_en+1] = i_src[l_en+2];
+            o_dst[l_en+2] = i_src[l_en+3];
+            o_dst[l_en+3] = i_src[l_en+0];
+        }
+        else{
+            o_dst[l_en+0] = i_src[l_en+3];
+            o_dst[l_en+1] = i_src[l_en+0];
+            o_dst[l_en+2] = i_src[l_en+1];
+            o_dst[l_en+3] = i_src[l_en+2];
+        }
+    }
+}
+
+/**
+ * Packs row-major C (m, n) into the gemm layout, in which every group of four
+ * columns is stored as (1, 2, 3, 0).
+ *
+ * @param io_pool thread pool.
+ * @param i_c row-major C, NULL to fill the packed C with i_value.
+ * @param i_value value of all elements if i_c is NULL.
+ * @param i_m rows of C.
+ * @param i_n columns of C, multiple of 4.
+ * @param o_c packed C.
+ **/
+template< typename T >
+void pack_c( thread_pool & io_pool,
+             const T     * i_c,
+             T             i_value,
+             std::size_t   i_m,
+             std::size_t   i_n,
+             T           * o_c ){
+    std::size_t l_rows_per_thread = (i_m + io_pool.size() - 1) / io_pool.size();
+
+    io_pool.run( [&]( std::size_t i_id ){
+        std::size_t l_first = std::min( i_m, i_id * l_rows_per_thread );
+        std::size_t l_last  = std::min( i_m, l_first + l_rows_per_thread );
+
+        if( i_c == NULL ){
+            std::fill( o_c + l_first*i_n, o_c + l_last*i_n, i_value );
+            return;
+        }
+        rotate_c( i_c + l_first*i_n,
+                  o_c + l_first*i_n,
+                  (l_last - l_first)*i_n,
+                  true );
+    } );
+}
+
+#endif
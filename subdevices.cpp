@@ -0,0 +1,364 @@
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "element_type.h"
+#include "gemm_kernel.h"
+#include "triad_kernel.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Partitions a device into sub-devices.
+ *
+ * @param i_device device which is partitioned.
+ * @param i_mode "equal" for CL_DEVICE_PARTITION_EQUALLY, "counts" for CL_DEVICE_PARTITION_BY_COUNTS.
+ * @param i_counts compute units per sub-device; one entry for "equal", one per sub-device for "counts".
+ * @param o_sub_devices will be set to the created sub-devices.
+ * @return true if the device was partitioned, false if partitioning is not supported or failed.
+ **/
+static bool partition_device( cl_device_id                  i_device,
+                              std::string const           & i_mode,
+                              std::vector< cl_uint > const  & i_counts,
+                              std::vector< cl_device_id >   & o_sub_devices ){
+    cl_uint l_max_sub_devices = 0;
+    cl_int l_err = clGetDeviceInfo( i_device,
+                                    CL_DEVICE_PARTITION_MAX_SUB_DEVICES,
+                                    sizeof(l_max_sub_devices),
+                                    &l_max_sub_devices,
+                                    NULL );
+    if( l_err != CL_SUCCESS || l_max_sub_devices < 2 ){
+        std::cout << "device does not support partitioning" << std::endl;
+        return false;
+    }
+    std::cout << "  CL_DEVICE_PARTITION_MAX_SUB_DEVICES: " << l_max_sub_devices << std::endl;
+
+    std::vector< cl_device_partition_property > l_properties;
+    if( i_mode == "counts" ){
+        l_properties.push_back( CL_DEVICE_PARTITION_BY_COUNTS );
+        for( std::size_t l_co = 0; l_co < i_counts.size(); l_co++ ){
+            l_properties.push_back( i_counts[l_co] );
+        }
+        l_properties.push_back( CL_DEVICE_PARTITION_BY_COUNTS_LIST_END );
+    }
+    else{
+        l_properties.push_back( CL_DEVICE_PARTITION_EQUALLY );
+        l_properties.push_back( i_counts[0] );
+    }
+    l_properties.push_back( 0 );
+
+    cl_uint l_n_sub_devices = 0;
+    l_err = clCreateSubDevices( i_device,
+                                l_properties.data(),
+                                0,
+                                NULL,
+                                &l_n_sub_devices );
+    if( l_err != CL_SUCCESS || l_n_sub_devices < 2 ){
+        std::cout << "partitioning failed with error " << l_err << std::endl;
+        return false;
+    }
+
+    o_sub_devices.resize( l_n_sub_devices );
+    l_err = clCreateSubDevices( i_device,
+                                l_properties.data(),
+                                l_n_sub_devices,
+                                o_sub_devices.data(),
+                                NULL );
+    assert( l_err == CL_SUCCESS );
+
+    for( cl_uint l_sd = 0; l_sd < l_n_sub_devices; l_sd++ ){
+        cl_uint l_compute_units = 0;
+        l_err = clGetDeviceInfo(    o_sub_devices[l_sd],
+                                    CL_DEVICE_MAX_COMPUTE_UNITS,
+                                    sizeof(l_compute_units),
+                                    &l_compute_units,
+                                    NULL );
+        assert( l_err == CL_SUCCESS );
+        std::cout << "  sub-device " << l_sd << ": " << l_compute_units << " compute units" << std::endl;
+    }
+
+    return true;
+}
+
+/**
+ * Enqueues a kernel several times.
+ *
+ * @param i_queue command queue.
+ * @param i_kernel kernel with all arguments set.
+ * @param i_global_size global work size (1D).
+ * @param i_n_reps number of repetitions.
+ **/
+static void enqueue_reps( cl_command_queue i_queue,
+                          cl_kernel        i_kernel,
+                          std::size_t      i_global_size,
+                          std::size_t      i_n_reps ){
+    for( std::size_t l_re = 0; l_re < i_n_reps; l_re++ ){
+        cl_int l_err = clEnqueueNDRangeKernel(  i_queue,
+                                                i_kernel,
+                                                1,
+                                                NULL,
+                                                &i_global_size,
+                                                NULL,
+                                                0,
+                                                NULL,
+                                                NULL );
+        assert( l_err == CL_SUCCESS );
+    }
+}
+
+int main( int i_argc, char * i_argv[] ){
+    std::cout << "starting sub-device benchmark" << std::endl;
+
+    cl_int l_err = CL_SUCCESS;
+
+    // number of platforms
+    cl_uint l_n_platforms = 0;
+    l_err = clGetPlatformIDs( 0,
+                              NULL,
+                              &l_n_platforms );
+    assert( l_err == CL_SUCCESS );
+    std::cout << "number of platforms: " << l_n_platforms << std::endl;
+    assert( l_n_platforms > 0);
+
+    // platform IDs
+    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
+    l_err = clGetPlatformIDs( l_n_platforms,
+                              l_platform_ids,
+                              NULL);
+    assert( l_err == CL_SUCCESS );
+
+    cl_char l_tmp_string[8192] = {0};
+
+    // platform name
+    l_err = clGetPlatformInfo(  l_platform_ids[0],
+                                CL_PLATFORM_NAME,
+                                sizeof(l_tmp_string),
+                                &l_tmp_string,
+                                NULL );
+    assert( l_err == CL_SUCCESS);
+
+    std::cout << "  CL_PLATFORM_NAME: " << l_tmp_string << std::endl;
+
+    // number of devices
+    cl_uint l_n_devices = 0;
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            0,
+                            NULL,
+                            &l_n_devices );
+    assert( l_err == CL_SUCCESS );
+
+    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            l_n_devices,
+                            l_device_ids,
+                            NULL );
+    assert( l_err == CL_SUCCESS );
+
+    cl_uint l_max_compute_units = 0;
+    l_err = clGetDeviceInfo(    l_device_ids[0],
+                                CL_DEVICE_MAX_COMPUTE_UNITS,
+                                sizeof(l_max_compute_units),
+                                &l_max_compute_units,
+                                NULL );
+    assert( l_err == CL_SUCCESS );
+
+    std::cout << "  CL_DEVICE_MAX_COMPUTE_UNITS: " << l_max_compute_units << std::endl;
+
+    /*
+     * partition the device: subdevices [equal <cus> | counts <cus_triad> <cus_gemm>]
+     * default is two equal halves
+     */
+    std::string l_mode = i_argc > 1 ? i_argv[1] : "equal";
+    std::vector< cl_uint > l_counts( 1, l_max_compute_units > 1 ? l_max_compute_units/2 : 1 );
+    bool l_valid = i_argc == 1 || ( l_mode == "equal" && i_argc == 3 ) || ( l_mode == "counts" && i_argc == 4 );
+    if( l_valid && i_argc > 1 ){
+        l_counts.resize( i_argc-2 );
+        for( int l_ar = 2; l_ar < i_argc; l_ar++ ){
+            l_counts[l_ar-2] = std::strtoul( i_argv[l_ar], NULL, 10 );
+            l_valid = l_valid && l_counts[l_ar-2] > 0;
+        }
+    }
+    if( !l_valid ){
+        std::cerr << "usage: subdevices [equal <cus> | counts <cus_triad> <cus_gemm>] with positive compute unit counts" << std::endl;
+        return 1;
+    }
+
+    std::vector< cl_device_id > l_sub_devices;
+    bool l_partitioned = partition_device( l_device_ids[0],
+                                           l_mode,
+                                           l_counts,
+                                           l_sub_devices );
+    cl_device_id l_triad_device = l_device_ids[0];
+    cl_device_id l_gemm_device = l_device_ids[0];
+    if( l_partitioned ){
+        l_triad_device = l_sub_devices[0];
+        l_gemm_device = l_sub_devices[1];
+    }
+    else{
+        std::cout << "running both workloads on the whole device with separate queues" << std::endl;
+    }
+
+    /*
+     * prepare program execution
+     */
+    cl_device_id l_context_devices[2] = { l_triad_device, l_gemm_device };
+    cl_context l_context = clCreateContext( NULL,
+                                            l_partitioned ? 2 : 1,
+                                            l_context_devices,
+                                            NULL,
+                                            NULL,
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_command_queue l_triad_queue = clCreateCommandQueue(  l_context,
+                                                            l_triad_device,
+                                                            0,
+                                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    cl_command_queue l_gemm_queue = clCreateCommandQueue(   l_context,
+                                                            l_gemm_device,
+                                                            0,
+                                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    const std::size_t l_n_reps = 10;
+
+    // triad workload
+    std::size_t l_n_values = 1 << 22;
+    cl_kernel l_triad = build_kernel(   l_context,
+                                        l_triad_device,
+                                        l_my_triad,
+                                        "triad",
+                                        "" );
+    if( l_triad == NULL ){
+        return 1;
+    }
+
+    std::vector< cl_float > l_triad_host( l_n_values, 1 );
+    cl_mem l_triad_buffers[3];
+    for( int l_bu = 0; l_bu < 3; l_bu++ ){
+        l_triad_buffers[l_bu] = clCreateBuffer( l_context,
+                                                CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                                sizeof(cl_float)*l_n_values,
+                                                l_triad_host.data(),
+                                                &l_err );
+        assert( l_err == CL_SUCCESS );
+
+        l_err = clSetKernelArg( l_triad,
+                                l_bu,
+                                sizeof(cl_mem),
+                                l_triad_buffers+l_bu );
+        assert( l_err == CL_SUCCESS );
+    }
+
+    // gemm workload
+    std::size_t l_m = 512;
+    std::size_t l_n = 512;
+    std::size_t l_k = 512;
+    cl_kernel l_gemm = get_gemm_kernel< cl_float >( l_context,
+                                                    l_gemm_device,
+                                                    l_m,
+                                                    l_n,
+                                                    l_k );
+    if( l_gemm == NULL ){
+        return 1;
+    }
+
+    std::vector< cl_float > l_gemm_host( l_m*l_k + l_k*l_n + l_m*l_n, 1 );
+    std::size_t l_gemm_sizes[3] = { l_m*l_k, l_k*l_n, l_m*l_n };
+    std::size_t l_gemm_offset = 0;
+    cl_mem l_gemm_buffers[3];
+    for( int l_bu = 0; l_bu < 3; l_bu++ ){
+        l_gemm_buffers[l_bu] = clCreateBuffer(  l_context,
+                                                CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                                sizeof(cl_float)*l_gemm_sizes[l_bu],
+                                                l_gemm_host.data()+l_gemm_offset,
+                                                &l_err );
+        assert( l_err == CL_SUCCESS );
+        l_gemm_offset += l_gemm_sizes[l_bu];
+
+        l_err = clSetKernelArg( l_gemm,
+                                l_bu,
+                                sizeof(cl_mem),
+                                l_gemm_buffers+l_bu );
+        assert( l_err == CL_SUCCESS );
+    }
+    cl_uint l_gemm_args[3] = { static_cast<cl_uint>(l_m),
+                               static_cast<cl_uint>(l_n),
+                               static_cast<cl_uint>(l_k) };
+    for( int l_ar = 0; l_ar < 3; l_ar++ ){
+        l_err = clSetKernelArg( l_gemm,
+                                3+l_ar,
+                                sizeof(cl_uint),
+                                l_gemm_args+l_ar );
+        assert( l_err == CL_SUCCESS );
+    }
+    std::size_t l_gemm_global_size = l_m/4*l_n/8;
+
+    // warm up
+    enqueue_reps( l_triad_queue, l_triad, l_n_values,         1 );
+    enqueue_reps( l_gemm_queue,  l_gemm,  l_gemm_global_size, 1 );
+    clFinish( l_triad_queue );
+    clFinish( l_gemm_queue );
+
+    // back to back
+    std::chrono::steady_clock::time_point l_tp0 = std::chrono::steady_clock::now();
+    enqueue_reps( l_triad_queue, l_triad, l_n_values, l_n_reps );
+    clFinish( l_triad_queue );
+    std::chrono::steady_clock::time_point l_tp1 = std::chrono::steady_clock::now();
+    enqueue_reps( l_gemm_queue, l_gemm, l_gemm_global_size, l_n_reps );
+    clFinish( l_gemm_queue );
+    std::chrono::steady_clock::time_point l_tp2 = std::chrono::steady_clock::now();
+
+    // concurrent
+    enqueue_reps( l_triad_queue, l_triad, l_n_values,         l_n_reps );
+    enqueue_reps( l_gemm_queue,  l_gemm,  l_gemm_global_size, l_n_reps );
+    clFlush( l_triad_queue );
+    clFlush( l_gemm_queue );
+    clFinish( l_triad_queue );
+    clFinish( l_gemm_queue );
+    std::chrono::steady_clock::time_point l_tp3 = std::chrono::steady_clock::now();
+
+    double l_time_triad = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp1 - l_tp0 ).count();
+    double l_time_gemm  = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp2 - l_tp1 ).count();
+    double l_time_seq   = l_time_triad + l_time_gemm;
+    double l_time_conc  = std::chrono::duration_cast< std::chrono::duration< double > >( l_tp3 - l_tp2 ).count();
+
+    double l_triad_gb   = 1.0E-9 * l_n_reps * 3 * sizeof(cl_float) * l_n_values;
+    double l_gemm_gflop = 1.0E-9 * l_n_reps * 2 * l_m * l_n * l_k;
+
+    std::cout << "back to back:" << std::endl;
+    std::cout << "  triad: " << l_time_triad << " s, " << l_triad_gb / l_time_triad << " GB/s" << std::endl;
+    std::cout << "  gemm:  " << l_time_gemm  << " s, " << l_gemm_gflop / l_time_gemm << " GFLOPS" << std::endl;
+    std::cout << "  total: " << l_time_seq   << " s, " << l_triad_gb / l_time_seq << " GB/s + " << l_gemm_gflop / l_time_seq << " GFLOPS" << std::endl;
+    std::cout << "concurrent:" << std::endl;
+    std::cout << "  total: " << l_time_conc  << " s, " << l_triad_gb / l_time_conc << " GB/s + " << l_gemm_gflop / l_time_conc << " GFLOPS" << std::endl;
+    std::cout << "speedup: " << l_time_seq / l_time_conc << std::endl;
+
+    for( int l_bu = 0; l_bu < 3; l_bu++ ){
+        clReleaseMemObject( l_triad_buffers[l_bu] );
+        clReleaseMemObject( l_gemm_buffers[l_bu] );
+    }
+    clReleaseKernel( l_triad );
+    clReleaseCommandQueue( l_triad_queue );
+    clReleaseCommandQueue( l_gemm_queue );
+    clReleaseContext( l_context );
+    for( std::size_t l_sd = 0; l_sd < l_sub_devices.size(); l_sd++ ){
+        clReleaseDevice( l_sub_devices[l_sd] );
+    }
+
+    delete [] l_device_ids;
+    delete [] l_platform_ids;
+
+    std::cout << "sub-device benchmark ended" << std::endl;
+}
@@ -0,0 +1,195 @@
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "task_graph.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * Builds and runs the example graph: a triad pipeline and two independent gemms.
+ * The graph and its queues are released on return.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the graph runs.
+ * @param i_n_queues number of in-order queues, 0 for an out-of-order queue if supported.
+ * @return 0 if the results are correct, 1 otherwise.
+ **/
+int run_task_graph( cl_context   i_context,
+                    cl_device_id i_device,
+                    std::size_t  i_n_queues ){
+    cl_int l_err = CL_SUCCESS;
+
+    task_graph l_graph( i_context,
+                        i_device,
+                        i_n_queues );
+    std::cout << "running on " << l_graph.n_queues() << ( l_graph.out_of_order() ? " out-of-order" : " in-order" ) << " queue(s)" << std::endl;
+
+    // triad pipeline: z = x + 2*y, w = z, v = w + 2*z
+    std::size_t l_n_values = 1 << 22;
+    std::vector< cl_float > l_x( l_n_values, 1 );
+    std::vector< cl_float > l_y( l_n_values, 2 );
+    std::vector< cl_float > l_v( l_n_values, 0 );
+    cl_mem l_triad_buffers[5];
+    for( int l_bu = 0; l_bu < 5; l_bu++ ){
+        l_triad_buffers[l_bu] = clCreateBuffer( i_context,
+                                                CL_MEM_READ_WRITE,
+                                                sizeof(cl_float)*l_n_values,
+                                                NULL,
+                                                &l_err );
+        assert( l_err == CL_SUCCESS );
+    }
+    cl_mem l_x_device = l_triad_buffers[0];
+    cl_mem l_y_device = l_triad_buffers[1];
+    cl_mem l_z_device = l_triad_buffers[2];
+    cl_mem l_w_device = l_triad_buffers[3];
+    cl_mem l_v_device = l_triad_buffers[4];
+
+    // two independent gemms C_i += A_i*B_i with A_i = B_i = 1 and C_i = 0
+    std::size_t l_m = 512;
+    std::size_t l_n = 512;
+    std::size_t l_k = 512;
+    std::vector< cl_float > l_ones( l_m*l_k, 1 );
+    std::vector< cl_float > l_zeros( l_m*l_n, 0 );
+    std::vector< cl_float > l_c[2] = { std::vector< cl_float >( l_m*l_n, 0 ),
+                                       std::vector< cl_float >( l_m*l_n, 0 ) };
+    std::size_t l_gemm_sizes[3] = { l_m*l_k, l_k*l_n, l_m*l_n };
+    cl_mem l_gemm_buffers[2][3];
+    for( int l_ge = 0; l_ge < 2; l_ge++ ){
+        for( int l_bu = 0; l_bu < 3; l_bu++ ){
+            l_gemm_buffers[l_ge][l_bu] = clCreateBuffer(    i_context,
+                                                            CL_MEM_READ_WRITE,
+                                                            sizeof(cl_float)*l_gemm_sizes[l_bu],
+                                                            NULL,
+                                                            &l_err );
+            assert( l_err == CL_SUCCESS );
+        }
+    }
+
+    // declare the graph, dependencies follow from the buffers
+    l_graph.add_write( l_x_device, l_x.data(), sizeof(cl_float)*l_n_values, "write x" );
+    l_graph.add_write( l_y_device, l_y.data(), sizeof(cl_float)*l_n_values, "write y" );
+    for( int l_ge = 0; l_ge < 2; l_ge++ ){
+        std::string l_id = std::to_string( l_ge );
+        l_graph.add_write( l_gemm_buffers[l_ge][0], l_ones.data(),  sizeof(cl_float)*l_m*l_k, "write A" + l_id );
+        l_graph.add_write( l_gemm_buffers[l_ge][1], l_ones.data(),  sizeof(cl_float)*l_k*l_n, "write B" + l_id );
+        l_graph.add_write( l_gemm_buffers[l_ge][2], l_zeros.data(), sizeof(cl_float)*l_m*l_n, "write C" + l_id );
+    }
+    l_graph.add_triad( l_x_device, l_y_device, l_z_device, l_n_values, "triad z" );
+    l_graph.add_copy( l_z_device, l_w_device, sizeof(cl_float)*l_n_values, "copy z -> w" );
+    l_graph.add_triad( l_w_device, l_z_device, l_v_device, l_n_values, "triad v" );
+    l_graph.add_read( l_v_device, l_v.data(), sizeof(cl_float)*l_n_values, "read v" );
+    for( int l_ge = 0; l_ge < 2; l_ge++ ){
+        std::string l_id = std::to_string( l_ge );
+        if( l_graph.add_gemm( l_gemm_buffers[l_ge][0],
+                              l_gemm_buffers[l_ge][1],
+                              l_gemm_buffers[l_ge][2],
+                              l_m,
+                              l_n,
+                              l_k,
+                              "gemm " + l_id ) == std::size_t(-1) ){
+            return 1;
+        }
+        l_graph.add_read( l_gemm_buffers[l_ge][2], l_c[l_ge].data(), sizeof(cl_float)*l_m*l_n, "read C" + l_id );
+    }
+
+    // warm up, then measure
+    l_graph.run();
+    l_graph.run();
+    l_graph.report();
+
+    // v = (1 + 2*2) + 2*(1 + 2*2) = 15, C = k
+    bool l_correct = l_v[0] == 15 && l_v[l_n_values-1] == 15;
+    for( int l_ge = 0; l_ge < 2; l_ge++ ){
+        l_correct = l_correct && l_c[l_ge][0] == l_k && l_c[l_ge][l_m*l_n-1] == l_k;
+    }
+    std::cout << ( l_correct ? "results are correct" : "results are wrong" ) << std::endl;
+
+    for( int l_bu = 0; l_bu < 5; l_bu++ ){
+        clReleaseMemObject( l_triad_buffers[l_bu] );
+    }
+    for( int l_ge = 0; l_ge < 2; l_ge++ ){
+        for( int l_bu = 0; l_bu < 3; l_bu++ ){
+            clReleaseMemObject( l_gemm_buffers[l_ge][l_bu] );
+        }
+    }
+
+    return l_correct ? 0 : 1;
+}
+
+int main( int i_argc, char * i_argv[] ){
+    std::cout << "starting task graph" << std::endl;
+
+    cl_int l_err = CL_SUCCESS;
+
+    // number of platforms
+    cl_uint l_n_platforms = 0;
+    l_err = clGetPlatformIDs( 0,
+                              NULL,
+                              &l_n_platforms );
+    assert( l_err == CL_SUCCESS );
+    std::cout << "number of platforms: " << l_n_platforms << std::endl;
+    assert( l_n_platforms > 0);
+
+    // platform IDs
+    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
+    l_err = clGetPlatformIDs( l_n_platforms,
+                              l_platform_ids,
+                              NULL);
+    assert( l_err == CL_SUCCESS );
+
+    // number of devices
+    cl_uint l_n_devices = 0;
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            0,
+                            NULL,
+                            &l_n_devices );
+    assert( l_err == CL_SUCCESS );
+
+    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            l_n_devices,
+                            l_device_ids,
+                            NULL );
+    assert( l_err == CL_SUCCESS );
+
+    /*
+     * prepare program execution
+     */
+    cl_context l_context = clCreateContext( NULL,
+                                            1,
+                                            l_device_ids+0,
+                                            NULL,
+                                            NULL,
+                                            &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    /*
+     * queues: task_graph [n_queues]
+     * 0 (default) uses an out-of-order queue if supported, n > 0 uses n in-order queues,
+     * 1 serializes the graph as a baseline
+     */
+    std::size_t l_n_queues = 0;
+    if( i_argc > 1 ){
+        l_n_queues = std::strtoul( i_argv[1], NULL, 10 );
+    }
+    int l_ret = run_task_graph( l_context,
+                                l_device_ids[0],
+                                l_n_queues );
+    clReleaseContext( l_context );
+
+    delete [] l_device_ids;
+    delete [] l_platform_ids;
+
+    std::cout << "task graph ended" << std::endl;
+
+    return l_ret;
+}
@@ -0,0 +1,522 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include "element_type.h"
+#include "gemm_kernel.h"
+#include "triad_kernel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * DAG of float transfers, copies, triads and gemms.
+ * Every node declares the buffers it reads and writes; dependencies follow from the
+ * order in which nodes are added (read after write, write after read, write after write).
+ * run() maps the nodes onto one out-of-order queue, or onto several in-order queues if the
+ * device has no out-of-order support, and passes the dependencies as event wait lists.
+ * report() compares the critical path with the total work using the profiling events.
+ **/
+class task_graph {
+    public:
+        /**
+         * Creates the queues and builds the triad kernel.
+         *
+         * @param i_context OpenCL context.
+         * @param i_device device on which the graph runs.
+         * @param i_n_queues number of in-order queues, 0 to use an out-of-order queue if supported (otherwise 4 in-order queues).
+         **/
+        task_graph( cl_context   i_context,
+                    cl_device_id i_device,
+                    std::size_t  i_n_queues = 0 ) : m_context( i_context ),
+                                                    m_device( i_device ){
+            cl_int l_err = CL_SUCCESS;
+
+            cl_command_queue_properties l_properties = 0;
+            l_err = clGetDeviceInfo(    i_device,
+                                        CL_DEVICE_QUEUE_PROPERTIES,
+                                        sizeof(l_properties),
+                                        &l_properties,
+                                        NULL );
+            assert( l_err == CL_SUCCESS );
+
+            m_out_of_order = i_n_queues == 0 && (l_properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+            if( i_n_queues == 0 ){
+                i_n_queues = m_out_of_order ? 1 : 4;
+            }
+
+            for( std::size_t l_qu = 0; l_qu < i_n_queues; l_qu++ ){
+                m_queues.push_back( clCreateCommandQueue(   i_context,
+                                                            i_device,
+                                                            CL_QUEUE_PROFILING_ENABLE | (m_out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0),
+                                                            &l_err ) );
+                assert( l_err == CL_SUCCESS );
+            }
+
+            m_triad = build_kernel( i_context,
+                                    i_device,
+                                    l_my_triad,
+                                    "triad",
+                                    "" );
+            assert( m_triad != NULL );
+        }
+
+        /**
+         * Releases the events, queues and the triad kernel.
+         **/
+        ~task_graph(){
+            release_events();
+            for( std::size_t l_qu = 0; l_qu < m_queues.size(); l_qu++ ){
+                clReleaseCommandQueue( m_queues[l_qu] );
+            }
+            clReleaseKernel( m_triad );
+        }
+
+        task_graph( task_graph const & ) = delete;
+        task_graph & operator=( task_graph const & ) = delete;
+
+        /**
+         * @return true if the graph runs on an out-of-order queue.
+         **/
+        bool out_of_order() const {
+            return m_out_of_order;
+        }
+
+        /**
+         * @return number of queues.
+         **/
+        std::size_t n_queues() const {
+            return m_queues.size();
+        }
+
+        /**
+         * Adds a host to device transfer. The host memory has to stay valid until run() returns.
+         *
+         * @param o_buffer device buffer.
+         * @param i_host host memory.
+         * @param i_bytes number of bytes.
+         * @param i_name name in the report.
+         * @return id of the node.
+         **/
+        std::size_t add_write( cl_mem              o_buffer,
+                               const void        * i_host,
+                               std::size_t         i_bytes,
+                               std::string const & i_name ){
+            node l_node = new_node( WRITE, i_name );
+            l_node.writes.push_back( o_buffer );
+            l_node.host = const_cast< void * >( i_host );
+            l_node.size[0] = i_bytes;
+            return add_node( l_node );
+        }
+
+        /**
+         * Adds a device to host transfer.
+         *
+         * @param i_buffer device buffer.
+         * @param o_host host memory, valid after run() returned.
+         * @param i_bytes number of bytes.
+         * @param i_name name in the report.
+         * @return id of the node.
+         **/
+        std::size_t add_read( cl_mem              i_buffer,
+                              void              * o_host,
+                              std::size_t         i_bytes,
+                              std::string const & i_name ){
+            node l_node = new_node( READ, i_name );
+            l_node.reads.push_back( i_buffer );
+            l_node.host = o_host;
+            l_node.size[0] = i_bytes;
+            return add_node( l_node );
+        }
+
+        /**
+         * Adds a device to device copy.
+         *
+         * @param i_src source buffer.
+         * @param o_dst destination buffer.
+         * @param i_bytes number of bytes.
+         * @param i_name name in the report.
+         * @return id of the node.
+         **/
+        std::size_t add_copy( cl_mem              i_src,
+                              cl_mem              o_dst,
+                              std::size_t         i_bytes,
+                              std::string const & i_name ){
+            node l_node = new_node( COPY, i_name );
+            l_node.reads.push_back( i_src );
+            l_node.writes.push_back( o_dst );
+            l_node.size[0] = i_bytes;
+            return add_node( l_node );
+        }
+
+        /**
+         * Adds a triad c = a + 2*b.
+         *
+         * @param i_a buffer a.
+         * @param i_b buffer b.
+         * @param o_c buffer c.
+         * @param i_n_values number of values.
+         * @param i_name name in the report.
+         * @return id of the node.
+         **/
+        std::size_t add_triad( cl_mem              i_a,
+                               cl_mem              i_b,
+                               cl_mem              o_c,
+                               std::size_t         i_n_values,
+                               std::string const & i_name ){
+            node l_node = new_node( TRIAD, i_name );
+            l_node.reads.push_back( i_a );
+            l_node.reads.push_back( i_b );
+            l_node.writes.push_back( o_c );
+            l_node.size[0] = i_n_values;
+            return add_node( l_node );
+        }
+
+        /**
+         * Adds a gemm C += A*B in the layout of gemm_kernel.h.
+         *
+         * @param i_a buffer A.
+         * @param i_b buffer B.
+         * @param io_c buffer C.
+         * @param i_m number of rows of A and C.
+         * @param i_n number of columns of B and C.
+         * @param i_k number of columns of A and rows of B.
+         * @param i_name name in the report.
+         * @return id of the node, or -1 if the kernel could not be built.
+         **/
+        std::size_t add_gemm( cl_mem              i_a,
+                              cl_mem              i_b,
+                              cl_mem              io_c,
+                              std::size_t         i_m,
+                              std::size_t         i_n,
+                              std::size_t         i_k,
+                              std::string const & i_name ){
+            node l_node = new_node( GEMM, i_name );
+            l_node.kernel = get_gemm_kernel< cl_float >( m_context,
+                                                         m_device,
+                                                         i_m,
+                                                         i_n,
+                                                         i_k );
+            if( l_node.kernel == NULL ){
+                return std::size_t(-1);
+            }
+            l_node.reads.push_back( i_a );
+            l_node.reads.push_back( i_b );
+            l_node.reads.push_back( io_c );
+            l_node.writes.push_back( io_c );
+            l_node.size[0] = i_m;
+            l_node.size[1] = i_n;
+            l_node.size[2] = i_k;
+            return add_node( l_node );
+        }
+
+        /**
+         * Enqueues all nodes with their dependencies as event wait lists and waits for completion.
+         * Can be called repeatedly, e.g. once for warm up.
+         **/
+        void run(){
+            cl_int l_err = CL_SUCCESS;
+            release_events();
+
+            std::vector< std::size_t > l_tails( m_queues.size(), std::size_t(-1) );
+            std::size_t l_next_queue = 0;
+
+            for( std::size_t l_no = 0; l_no < m_nodes.size(); l_no++ ){
+                node & l_node = m_nodes[l_no];
+
+                // queue: continue the chain of a dependency, otherwise an idle (empty or completed) or the next queue
+                std::size_t l_queue = m_queues.size();
+                for( std::size_t l_qu = 0; l_qu < m_queues.size() && l_queue == m_queues.size(); l_qu++ ){
+                    if( std::find( l_node.deps.begin(), l_node.deps.end(), l_tails[l_qu] ) != l_node.deps.end() ){
+                        l_queue = l_qu;
+                    }
+                }
+                for( std::size_t l_qu = 0; l_qu < m_queues.size() && l_queue == m_queues.size(); l_qu++ ){
+                    if( l_tails[l_qu] == std::size_t(-1) || completed( m_nodes[ l_tails[l_qu] ].event ) ){
+                        l_queue = l_qu;
+                    }
+                }
+                if( l_queue == m_queues.size() ){
+                    l_queue = l_next_queue;
+                    l_next_queue = (l_next_queue+1) % m_queues.size();
+                }
+                l_tails[l_queue] = l_no;
+                l_node.queue = l_queue;
+
+                std::vector< cl_event > l_wait;
+                for( std::size_t l_de = 0; l_de < l_node.deps.size(); l_de++ ){
+                    l_wait.push_back( m_nodes[ l_node.deps[l_de] ].event );
+                }
+                cl_uint l_n_wait = static_cast< cl_uint >( l_wait.size() );
+                const cl_event * l_wait_list = l_wait.empty() ? NULL : l_wait.data();
+                cl_command_queue l_cq = m_queues[l_queue];
+
+                if( l_node.type == WRITE ){
+                    l_err = clEnqueueWriteBuffer(   l_cq,
+                                                    l_node.writes[0],
+                                                    CL_FALSE,
+                                                    0,
+                                                    l_node.size[0],
+                                                    l_node.host,
+                                                    l_n_wait,
+                                                    l_wait_list,
+                                                    &l_node.event );
+                }
+                else if( l_node.type == READ ){
+                    l_err = clEnqueueReadBuffer(    l_cq,
+                                                    l_node.reads[0],
+                                                    CL_FALSE,
+                                                    0,
+                                                    l_node.size[0],
+                                                    l_node.host,
+                                                    l_n_wait,
+                                                    l_wait_list,
+                                                    &l_node.event );
+                }
+                else if( l_node.type == COPY ){
+                    l_err = clEnqueueCopyBuffer(    l_cq,
+                                                    l_node.reads[0],
+                                                    l_node.writes[0],
+                                                    0,
+                                                    0,
+                                                    l_node.size[0],
+                                                    l_n_wait,
+                                                    l_wait_list,
+                                                    &l_node.event );
+                }
+                else{
+                    // arguments are captured at enqueue, so kernels can be shared by nodes
+                    std::size_t l_global_size = l_node.size[0];
+                    if( l_node.type == TRIAD ){
+                        cl_mem l_mems[3] = { l_node.reads[0], l_node.reads[1], l_node.writes[0] };
+                        set_args( m_triad, l_mems, NULL );
+                    }
+                    else{
+                        cl_mem l_mems[3] = { l_node.reads[0], l_node.reads[1], l_node.writes[0] };
+                        cl_uint l_uints[3] = { static_cast< cl_uint >( l_node.size[0] ),
+                                               static_cast< cl_uint >( l_node.size[1] ),
+                                               static_cast< cl_uint >( l_node.size[2] ) };
+                        set_args( l_node.kernel, l_mems, l_uints );
+                        l_global_size = l_node.size[0]/4*l_node.size[1]/8;
+                    }
+                    l_err = clEnqueueNDRangeKernel( l_cq,
+                                                    l_node.type == TRIAD ? m_triad : l_node.kernel,
+                                                    1,
+                                                    NULL,
+                                                    &l_global_size,
+                                                    NULL,
+                                                    l_n_wait,
+                                                    l_wait_list,
+                                                    &l_node.event );
+                }
+                assert( l_err == CL_SUCCESS );
+            }
+
+            for( std::size_t l_qu = 0; l_qu < m_queues.size(); l_qu++ ){
+                l_err = clFlush( m_queues[l_qu] );
+                assert( l_err == CL_SUCCESS );
+            }
+            for( std::size_t l_qu = 0; l_qu < m_queues.size(); l_qu++ ){
+                l_err = clFinish( m_queues[l_qu] );
+                assert( l_err == CL_SUCCESS );
+            }
+
+            for( std::size_t l_no = 0; l_no < m_nodes.size(); l_no++ ){
+                l_err  = clGetEventProfilingInfo( m_nodes[l_no].event,
+                                                  CL_PROFILING_COMMAND_START,
+                                                  sizeof(cl_ulong),
+                                                  &m_nodes[l_no].start,
+                                                  NULL );
+                l_err |= clGetEventProfilingInfo( m_nodes[l_no].event,
+                                                  CL_PROFILING_COMMAND_END,
+                                                  sizeof(cl_ulong),
+                                                  &m_nodes[l_no].end,
+                                                  NULL );
+                assert( l_err == CL_SUCCESS );
+            }
+        }
+
+        /**
+         * Prints the nodes' timings of the last run, the total work (sum of all durations),
+         * the makespan (first start to last end) and the critical path (longest dependency chain).
+         **/
+        void report() const {
+            if( m_nodes.empty() ){
+                return;
+            }
+
+            cl_ulong l_first = m_nodes[0].start;
+            cl_ulong l_last = m_nodes[0].end;
+            double l_work = 0;
+            std::vector< double > l_path( m_nodes.size(), 0 );      // longest chain ending in the node
+            std::vector< std::size_t > l_pred( m_nodes.size(), std::size_t(-1) );
+            std::size_t l_end_node = 0;
+
+            std::cout << "  node                 queue   start [ms]   duration [ms]" << std::endl;
+            for( std::size_t l_no = 0; l_no < m_nodes.size(); l_no++ ){
+                node const & l_node = m_nodes[l_no];
+                l_first = std::min( l_first, l_node.start );
+                l_last = std::max( l_last, l_node.end );
+            }
+            for( std::size_t l_no = 0; l_no < m_nodes.size(); l_no++ ){
+                node const & l_node = m_nodes[l_no];
+                double l_duration = (l_node.end - l_node.start) * 1.0E-6;
+                l_work += l_duration;
+
+                for( std::size_t l_de = 0; l_de < l_node.deps.size(); l_de++ ){
+                    if( l_path[ l_node.deps[l_de] ] > l_path[l_no] ){
+                        l_path[l_no] = l_path[ l_node.deps[l_de] ];
+                        l_pred[l_no] = l_node.deps[l_de];
+                    }
+                }
+                l_path[l_no] += l_duration;
+                if( l_path[l_no] > l_path[l_end_node] ){
+                    l_end_node = l_no;
+                }
+
+                std::cout << "  " << std::left << std::setw(20) << l_node.name << std::right
+                          << std::setw(6) << l_node.queue
+                          << std::setw(13) << (l_node.start - l_first) * 1.0E-6
+                          << std::setw(16) << l_duration << std::endl;
+            }
+
+            std::vector< std::string > l_critical;
+            for( std::size_t l_no = l_end_node; l_no != std::size_t(-1); l_no = l_pred[l_no] ){
+                l_critical.push_back( m_nodes[l_no].name );
+            }
+
+            double l_makespan = (l_last - l_first) * 1.0E-6;
+            std::cout << "total work:    " << l_work << " ms" << std::endl;
+            std::cout << "makespan:      " << l_makespan << " ms" << std::endl;
+            std::cout << "critical path: " << l_path[l_end_node] << " ms:";
+            for( std::size_t l_cr = l_critical.size(); l_cr > 0; l_cr-- ){
+                std::cout << " " << l_critical[l_cr-1];
+            }
+            std::cout << std::endl;
+            std::cout << "achieved concurrency (work / makespan):        " << l_work / l_makespan << std::endl;
+            std::cout << "available parallelism (work / critical path):  " << l_work / l_path[l_end_node] << std::endl;
+        }
+
+    private:
+        enum node_type { WRITE, READ, COPY, TRIAD, GEMM };
+
+        struct node {
+            node_type                  type;
+            std::string                name;
+            std::vector< cl_mem >      reads;
+            std::vector< cl_mem >      writes;
+            std::vector< std::size_t > deps;        // ids of the nodes this node waits for
+            void                     * host;        // host memory of transfers
+            std::size_t                size[3];     // bytes, values or m, n, k
+            cl_kernel                  kernel;
+            std::size_t                queue;
+            cl_event                   event;
+            cl_ulong                   start;
+            cl_ulong                   end;
+        };
+
+        node new_node( node_type           i_type,
+                       std::string const & i_name ) const {
+            node l_node;
+            l_node.type = i_type;
+            l_node.name = i_name;
+            l_node.host = NULL;
+            l_node.size[0] = l_node.size[1] = l_node.size[2] = 0;
+            l_node.kernel = NULL;
+            l_node.queue = 0;
+            l_node.event = NULL;
+            l_node.start = l_node.end = 0;
+            return l_node;
+        }
+
+        /**
+         * Derives the node's dependencies from the buffers it accesses and appends it.
+         **/
+        std::size_t add_node( node & io_node ){
+            std::size_t l_id = m_nodes.size();
+            for( std::size_t l_re = 0; l_re < io_node.reads.size(); l_re++ ){
+                // read after write
+                if( m_last_writer.count( io_node.reads[l_re] ) > 0 ){
+                    io_node.deps.push_back( m_last_writer[ io_node.reads[l_re] ] );
+                }
+            }
+            for( std::size_t l_wr = 0; l_wr < io_node.writes.size(); l_wr++ ){
+                cl_mem l_buffer = io_node.writes[l_wr];
+                // write after write and write after read
+                if( m_last_writer.count( l_buffer ) > 0 ){
+                    io_node.deps.push_back( m_last_writer[l_buffer] );
+                }
+                std::vector< std::size_t > & l_readers = m_readers[l_buffer];
+                io_node.deps.insert( io_node.deps.end(), l_readers.begin(), l_readers.end() );
+                l_readers.clear();
+            }
+            for( std::size_t l_re = 0; l_re < io_node.reads.size(); l_re++ ){
+                if( std::find( io_node.writes.begin(), io_node.writes.end(), io_node.reads[l_re] ) == io_node.writes.end() ){
+                    m_readers[ io_node.reads[l_re] ].push_back( l_id );
+                }
+            }
+            for( std::size_t l_wr = 0; l_wr < io_node.writes.size(); l_wr++ ){
+                m_last_writer[ io_node.writes[l_wr] ] = l_id;
+            }
+
+            std::sort( io_node.deps.begin(), io_node.deps.end() );
+            io_node.deps.erase( std::unique( io_node.deps.begin(), io_node.deps.end() ), io_node.deps.end() );
+            m_nodes.push_back( io_node );
+            return l_id;
+        }
+
+        static void set_args( cl_kernel       i_kernel,
+                              const cl_mem  * i_mems,
+                              const cl_uint * i_uints ){
+            for( cl_uint l_ar = 0; l_ar < 3; l_ar++ ){
+                cl_int l_err = clSetKernelArg(  i_kernel,
+                                                l_ar,
+                                                sizeof(cl_mem),
+                                                i_mems+l_ar );
+                assert( l_err == CL_SUCCESS );
+
+                if( i_uints != NULL ){
+                    l_err = clSetKernelArg( i_kernel,
+                                            3+l_ar,
+                                            sizeof(cl_uint),
+                                            i_uints+l_ar );
+                    assert( l_err == CL_SUCCESS );
+                }
+            }
+        }
+
+        static bool completed( cl_event i_event ){
+            cl_int l_status = CL_QUEUED;
+            cl_int l_err = clGetEventInfo(  i_event,
+                                            CL_EVENT_COMMAND_EXECUTION_STATUS,
+                                            sizeof(l_status),
+                                            &l_status,
+                                            NULL );
+            assert( l_err == CL_SUCCESS );
+            return l_status == CL_COMPLETE;
+        }
+
+        void release_events(){
+            for( std::size_t l_no = 0; l_no < m_nodes.size(); l_no++ ){
+                if( m_nodes[l_no].event != NULL ){
+                    clReleaseEvent( m_nodes[l_no].event );
+                    m_nodes[l_no].event = NULL;
+                }
+            }
+        }
+
+        cl_context                                     m_context;
+        cl_device_id                                   m_device;
+        bool                                           m_out_of_order = false;
+        std::vector< cl_command_queue >                m_queues;
+        cl_kernel                                      m_triad = NULL;
+        std::vector< node >                            m_nodes;
+        std::map< cl_mem, std::size_t >                m_last_writer;   // last node writing the buffer
+        std::map< cl_mem, std::vector< std::size_t > > m_readers;       // nodes reading the buffer since its last write
+};
+
+#endif
@@ -4,92 +4,30 @@
 #include <CL/cl.h>
 #endif
 
+#include "element_type.h"
+#include "triad_kernel.h"
+
 #include <cassert>
 #include <iostream>
-
-static const char * l_my_triad = R"(
-    __kernel void triad(    __global float * i_a,
-                            __global float * i_b,
-                            __global float * o_c ){
-        size_t l_gwid = get_global_id(0);
-        o_c[l_gwid] = i_a[l_gwid] + 2.0f * i_b[l_gwid];
-    }
-)";
-
-int main(){
-    std::cout << "starting device query" << std::endl;
-
+#include <string>
+
+/**
+ * Runs the triad kernel for the given element type.
+ *
+ * @param i_context OpenCL context.
+ * @param i_device device on which the kernel runs.
+ * @return 0 on success, 1 if the program could not be built.
+ **/
+template< typename T >
+int run_triad( cl_context   i_context,
+               cl_device_id i_device ){
     cl_int l_err = CL_SUCCESS;
-
-    // number of platforms
-    cl_uint l_n_platforms = 0;
-    l_err = clGetPlatformIDs( 0, 
-                              NULL, 
-                              &l_n_platforms );
-    assert( l_err == CL_SUCCESS );
-    std::cout << "number of platforms: " << l_n_platforms << std::endl;
-    assert( l_n_platforms > 0);
-
-    // platform IDs
-    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
-    l_err = clGetPlatformIDs( l_n_platforms, 
-                              l_platform_ids, 
-                              NULL);
-    assert( l_err == CL_SUCCESS );
-
     cl_char l_tmp_string[8192] = {0};
 
-    // platform name
-    l_err = clGetPlatformInfo(  l_platform_ids[0], 
-                                CL_PLATFORM_NAME, 
-                                sizeof(l_tmp_string), 
-                                &l_tmp_string, 
-                                NULL );   
-
-    assert( l_err == CL_SUCCESS);
-
-    std::cout << "  CL_PLATFORM_NAME: " << l_tmp_string << std::endl;
-
-    // number of devices
-    cl_uint l_n_devices = 0;
-    l_err = clGetDeviceIDs( l_platform_ids[0],
-                            CL_DEVICE_TYPE_ALL,
-                            0, 
-                            NULL, 
-                            &l_n_devices );
-    assert( l_err == CL_SUCCESS );
-
-    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
-    l_err = clGetDeviceIDs( l_platform_ids[0],
-                            CL_DEVICE_TYPE_ALL,
-                            l_n_devices,
-                            l_device_ids, 
-                            NULL );
-    assert( l_err == CL_SUCCESS );
-
-    l_err = clGetDeviceInfo(    l_device_ids[0],
-                                CL_DEVICE_OPENCL_C_VERSION,
-                                sizeof(l_tmp_string),
-                                &l_tmp_string, 
-                                NULL );
-    assert( l_err == CL_SUCCESS );
-
-    std::cout << "  CL_DEVICE_OPENCL_C_VERSION: " << l_tmp_string << std::endl;
-
-    /*
-     * prepare program execution
-     */
-    cl_context l_context = clCreateContext(   NULL,
-                                    1,
-                                    l_device_ids+0,
-                                    NULL,
-                                    NULL,
-                                    &l_err );
-    assert( l_err == CL_SUCCESS );
-
-    cl_program l_program = clCreateProgramWithSource(   l_context,
-                                                        1,
-                                                        &l_my_triad,
+    const char * l_sources[2] = { l_element_type_defs, l_my_triad };
+    cl_program l_program = clCreateProgramWithSource(   i_context,
+                                                        2,
+                                                        l_sources,
                                                         NULL,
                                                         &l_err );
     assert( l_err == CL_SUCCESS );
@@ -97,12 +35,12 @@ int main(){
     /*
      * build program 
      */
-    std::cout << "build program: " << std::endl;
+    std::cout << "build program for element type " << element_type< T >::name() << ": " << std::endl;
     std::cout << l_my_triad << std::endl;
     l_err = clBuildProgram( l_program,
-                            0,
-                            NULL,
-                            NULL,
+                            1,
+                            &i_device,
+                            element_type< T >::options(),
                             NULL,
                             NULL);
 
@@ -111,7 +49,7 @@ int main(){
         std::cerr << "failed to build program!" << std::endl;
 
         clGetProgramBuildInfo(  l_program,
-                                l_device_ids[0],
+                                i_device,
                                 CL_PROGRAM_BUILD_LOG,
                                 sizeof(l_tmp_string),
                                 l_tmp_string,
@@ -131,45 +69,45 @@ int main(){
     // allocate  host memory
     std::cout << "allocating host memory" << std::endl;
     std::size_t l_n_values = 7;
-    float *l_a_host = new float[l_n_values];
-    float *l_b_host = new float[l_n_values];
-    float *l_c_host = new float[l_n_values];
+    T *l_a_host = new T[l_n_values];
+    T *l_b_host = new T[l_n_values];
+    T *l_c_host = new T[l_n_values];
 
     // initialize host memory
     std::cout << "initializing host memory" << std::endl;
     for (std::size_t l_en = 0; l_en < l_n_values; l_en++)
     {
-        l_a_host[l_en] = l_en;
-        l_b_host[l_en] = 3*l_en;
-        l_c_host[l_en] = -1;
+        l_a_host[l_en] = element_type< T >::to_elem( l_en );
+        l_b_host[l_en] = element_type< T >::to_elem( 3*l_en );
+        l_c_host[l_en] = element_type< T >::to_elem( -1 );
     }
 
     std::cout << "allocation device memory" << std::endl;
 
-    cl_mem l_a_device = clCreateBuffer( l_context,
+    cl_mem l_a_device = clCreateBuffer( i_context,
                                         CL_MEM_READ_ONLY, 
-                                        sizeof(float)*l_n_values, 
+                                        sizeof(T)*l_n_values, 
                                         NULL, 
                                         &l_err );
     assert( l_err == CL_SUCCESS ); 
 
-    cl_mem l_b_device = clCreateBuffer( l_context,
+    cl_mem l_b_device = clCreateBuffer( i_context,
                                         CL_MEM_READ_ONLY, 
-                                        sizeof(float)*l_n_values, 
+                                        sizeof(T)*l_n_values, 
                                         NULL, 
                                         &l_err );
     assert( l_err == CL_SUCCESS ); 
 
-    cl_mem l_c_device = clCreateBuffer( l_context,
+    cl_mem l_c_device = clCreateBuffer( i_context,
                                         CL_MEM_WRITE_ONLY, 
-                                        sizeof(float)*l_n_values, 
+                                        sizeof(T)*l_n_values, 
                                         NULL, 
                                         &l_err );
     assert( l_err == CL_SUCCESS );
 
     // command queue
-    cl_command_queue l_queue = clCreateCommandQueue(    l_context, 
-                                                        l_device_ids[0], 
+    cl_command_queue l_queue = clCreateCommandQueue(    i_context, 
+                                                        i_device, 
                                                         0, 
                                                         &l_err );
 
@@ -179,7 +117,7 @@ int main(){
                                     l_a_device,
                                     CL_TRUE,
                                     0,
-                                    sizeof(float)*l_n_values,
+                                    sizeof(T)*l_n_values,
                                     l_a_host,
                                     0,
                                     NULL,
@@ -190,7 +128,7 @@ int main(){
                                     l_b_device,
                                     CL_TRUE,
                                     0,
-                                    sizeof(float)*l_n_values,
+                                    sizeof(T)*l_n_values,
                                     l_b_host,
                                     0,
                                     NULL,
@@ -240,7 +178,7 @@ int main(){
                                 l_c_device, 
                                 CL_TRUE, 
                                 0, 
-                                sizeof(float)*l_n_values, 
+                                sizeof(T)*l_n_values, 
                                 l_c_host, 
                                 0, 
                                 NULL, 
@@ -250,7 +188,7 @@ int main(){
     std::cout << "printing result" << std::endl;
     for (std::size_t l_en = 0; l_en < l_n_values; l_en++)
     {
-        std::cout << l_en << ": " << l_c_host[l_en] << std::endl;
+        std::cout << l_en << ": " << element_type< T >::to_double( l_c_host[l_en] ) << std::endl;
     }
 
 
@@ -259,8 +197,108 @@ int main(){
     delete [] l_b_host;
     delete [] l_c_host;
 
+    return 0;
+}
+
+int main( int i_argc, char * i_argv[] ){
+    std::cout << "starting device query" << std::endl;
+
+    cl_int l_err = CL_SUCCESS;
+
+    // number of platforms
+    cl_uint l_n_platforms = 0;
+    l_err = clGetPlatformIDs( 0, 
+                              NULL, 
+                              &l_n_platforms );
+    assert( l_err == CL_SUCCESS );
+    std::cout << "number of platforms: " << l_n_platforms << std::endl;
+    assert( l_n_platforms > 0);
+
+    // platform IDs
+    cl_platform_id *l_platform_ids = new cl_platform_id[ l_n_platforms ];
+    l_err = clGetPlatformIDs( l_n_platforms, 
+                              l_platform_ids, 
+                              NULL);
+    assert( l_err == CL_SUCCESS );
+
+    cl_char l_tmp_string[8192] = {0};
+
+    // platform name
+    l_err = clGetPlatformInfo(  l_platform_ids[0], 
+                                CL_PLATFORM_NAME, 
+                                sizeof(l_tmp_string), 
+                                &l_tmp_string, 
+                                NULL );   
+
+    assert( l_err == CL_SUCCESS);
+
+    std::cout << "  CL_PLATFORM_NAME: " << l_tmp_string << std::endl;
+
+    // number of devices
+    cl_uint l_n_devices = 0;
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            0, 
+                            NULL, 
+                            &l_n_devices );
+    assert( l_err == CL_SUCCESS );
+
+    cl_device_id *l_device_ids = new cl_device_id[l_n_devices];
+    l_err = clGetDeviceIDs( l_platform_ids[0],
+                            CL_DEVICE_TYPE_ALL,
+                            l_n_devices,
+                            l_device_ids, 
+                            NULL );
+    assert( l_err == CL_SUCCESS );
+
+    l_err = clGetDeviceInfo(    l_device_ids[0],
+                                CL_DEVICE_OPENCL_C_VERSION,
+                                sizeof(l_tmp_string),
+                                &l_tmp_string, 
+                                NULL );
+    assert( l_err == CL_SUCCESS );
+
+    std::cout << "  CL_DEVICE_OPENCL_C_VERSION: " << l_tmp_string << std::endl;
+
+    /*
+     * prepare program execution
+     */
+    cl_context l_context = clCreateContext(   NULL,
+                                    1,
+                                    l_device_ids+0,
+                                    NULL,
+                                    NULL,
+                                    &l_err );
+    assert( l_err == CL_SUCCESS );
+
+    // element type: triad [float|double|half]
+    std::string l_type = "float";
+    if( i_argc > 1 ){
+        l_type = i_argv[1];
+    }
+    if( l_type != "float" && l_type != "double" && l_type != "half" ){
+        std::cerr << "unknown element type " << l_type << ", usage: triad [float|double|half]" << std::endl;
+        return 1;
+    }
+
+    int l_ret = 0;
+    if( l_type == "double" && device_supports( l_device_ids[0], element_type< cl_double >::extension() ) ){
+        l_ret = run_triad< cl_double >( l_context, l_device_ids[0] );
+    }
+    else if( l_type == "half" && device_supports( l_device_ids[0], element_type< cl_half >::extension() ) ){
+        l_ret = run_triad< cl_half >( l_context, l_device_ids[0] );
+    }
+    else{
+        if( l_type != "float" ){
+            std::cout << "element type " << l_type << " is not supported by the device, falling back to float" << std::endl;
+        }
+        l_ret = run_triad< cl_float >( l_context, l_device_ids[0] );
+    }
+
     delete [] l_device_ids;
     delete [] l_platform_ids;
 
     std::cout << "device query ended" << std::endl;
+
+    return l_ret;
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef TRIAD_KERNEL_H
+#define TRIAD_KERNEL_H
+
+#include "element_type.h"
+
+/*
+ * c = a + 2*b, one element per work item.
+ * The element type is selected as described in element_type.h.
+ */
+static const char * l_my_triad = R"(
+    __kernel void triad(    __global elem_t * i_a,
+                            __global elem_t * i_b,
+                            __global elem_t * o_c ){
+        size_t l_gwid = get_global_id(0);
+        acc_t l_a = LOAD(l_gwid, i_a);
+        acc_t l_b = LOAD(l_gwid, i_b);
+        STORE(l_a + (acc_t)2 * l_b, l_gwid, o_c);
+    }
+)";
+
+#endif